@@ -0,0 +1,138 @@
+#include "bench.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+
+namespace
+{
+    const double BATCH_MS = 20;
+    const int BATCHES = 15;
+    const double QUICK_BATCH_MS = 2;
+    const int QUICK_BATCHES = 5;
+
+    std::atomic<uint64_t> allocations{0};
+}
+
+// every other form of new (arrays, nothrow) ends up here in the standard libraries we build with
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *memory = malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+uint64_t AllocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+BenchSuite::BenchSuite(int argc, char *argv[]) : batchNs(BATCH_MS * 1e6), batches(BATCHES)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            jsonPath = argv[++i];
+        else if (strcmp(argv[i], "--quick") == 0)
+        {
+            batchNs = QUICK_BATCH_MS * 1e6;
+            batches = QUICK_BATCHES;
+        }
+    }
+}
+
+void BenchSuite::SetContext(const std::string &key, const std::string &value)
+{
+    context.emplace_back(key, value);
+}
+
+bool BenchSuite::Selected(const std::string &name) const
+{
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+void BenchSuite::Record(const std::string &name, size_t bytesPerOp, uint64_t iterations, double allocationsPerOp,
+                        std::vector<double> &perOp)
+{
+    std::sort(perOp.begin(), perOp.end());
+    Result result{name, bytesPerOp, iterations, perOp[perOp.size() / 2], perOp.front(), allocationsPerOp};
+    results.push_back(result);
+
+    // progress for whoever is watching; the report itself goes to stdout or --json
+    if (bytesPerOp)
+        fprintf(stderr, "%-44s %12.1f ns/op %8.2f allocs/op %10.1f MB/s\n", name.c_str(), result.medianNs,
+                allocationsPerOp, bytesPerOp / result.medianNs * 1e3);
+    else
+        fprintf(stderr, "%-44s %12.1f ns/op %8.2f allocs/op\n", name.c_str(), result.medianNs, allocationsPerOp);
+}
+
+int BenchSuite::Finish()
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+
+    writer.StartObject();
+    writer.Key("context");
+    writer.StartObject();
+    for (const auto &entry : context)
+    {
+        writer.Key(entry.first.c_str());
+        writer.String(entry.second.c_str());
+    }
+    writer.EndObject();
+
+    writer.Key("benchmarks");
+    writer.StartArray();
+    for (const Result &result : results)
+    {
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(result.name.c_str());
+        writer.Key("iterations_per_batch");
+        writer.Uint64(result.iterations);
+        writer.Key("median_ns_per_op");
+        writer.Double(result.medianNs);
+        writer.Key("min_ns_per_op");
+        writer.Double(result.minNs);
+        writer.Key("allocations_per_op");
+        writer.Double(result.allocationsPerOp);
+        writer.Key("bytes_per_op");
+        writer.Uint64(result.bytesPerOp);
+        if (result.bytesPerOp)
+        {
+            writer.Key("mb_per_s");
+            writer.Double(result.bytesPerOp / result.medianNs * 1e3);
+        }
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    FILE *out = jsonPath.empty() ? stdout : fopen(jsonPath.c_str(), "w");
+    if (!out)
+    {
+        fprintf(stderr, "can't write %s\n", jsonPath.c_str());
+        return 1;
+    }
+    fprintf(out, "%s\n", buffer.GetString());
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
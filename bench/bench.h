@@ -0,0 +1,102 @@
+#pragma once
+
+// Small harness behind dmb_bench. Each case is calibrated to batches of at least BATCH_MS,
+// timed over several batches, and reported as median and best ns/op (plus MB/s when it has a
+// byte size) and heap allocations per op. The whole run is one JSON document, so CI can keep the
+// output and diff it.
+//
+//   dmb_bench [--filter <substring>] [--json <file>] [--quick]
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// operator new calls so far, on any thread; the harness replaces the global operator new to count
+uint64_t AllocationCount();
+
+class BenchSuite
+{
+public:
+    BenchSuite(int argc, char *argv[]);
+
+    template <typename Fn>
+    void Run(const std::string &name, size_t bytesPerOp, Fn &&fn)
+    {
+        if (!Selected(name))
+            return;
+
+        // warm up, then find a batch size that runs long enough to time
+        fn();
+        uint64_t iterations = 1;
+        for (;;)
+        {
+            const double ns = TimeBatch(iterations, fn);
+            if (ns >= batchNs || iterations >= (1ull << 30))
+                break;
+            iterations *= ns > 0 ? std::max<uint64_t>(2, static_cast<uint64_t>(batchNs / ns) + 1) : 16;
+        }
+
+        std::vector<double> perOp;
+        const uint64_t allocationsBefore = AllocationCount();
+        for (int i = 0; i < batches; ++i)
+            perOp.push_back(TimeBatch(iterations, fn) / iterations);
+        const double allocationsPerOp = static_cast<double>(AllocationCount() - allocationsBefore) / (iterations * batches);
+        Record(name, bytesPerOp, iterations, allocationsPerOp, perOp);
+    }
+
+    // whatever describes the build, written into the report's context
+    void SetContext(const std::string &key, const std::string &value);
+
+    // writes the report; 0 unless the output couldn't be written
+    int Finish();
+
+private:
+    struct Result
+    {
+        std::string name;
+        size_t bytesPerOp;
+        uint64_t iterations;
+        double medianNs;
+        double minNs;
+        double allocationsPerOp;
+    };
+
+    std::string filter;
+    std::string jsonPath;
+    double batchNs;
+    int batches;
+    std::vector<std::pair<std::string, std::string>> context;
+    std::vector<Result> results;
+
+    bool Selected(const std::string &name) const;
+    void Record(const std::string &name, size_t bytesPerOp, uint64_t iterations, double allocationsPerOp,
+                std::vector<double> &perOp);
+
+    template <typename Fn>
+    static double TimeBatch(uint64_t iterations, Fn &fn)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; ++i)
+            fn();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// keeps the optimizer from dropping a result nothing else reads
+template <typename T>
+inline void KeepAlive(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+#ifdef DMB_BENCH_QT
+// artwork cases, only when the GUI (and so Qt) is part of the build
+void RunArtworkBenchmarks(BenchSuite &suite);
+#endif
@@ -0,0 +1,440 @@
+// dmb_bench: the bridge's hot paths with realistic inputs, from the shared memory MusicBee leaves
+// a title in to the frame discord-rpc reads back. See bench.h for options and the report format.
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "discord_rpc.h"
+#include "history_log.h"
+#include "history_stats.h"
+#include "msg_queue.h"
+#include "musicbee_ipc.h"
+#include "presence_bridge.h"
+#include "presence_sinks.h"
+#include "rpc_connection.h"
+#include "serialization.h"
+#include "xxhash64.h"
+
+#ifndef _WIN32
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(RAPIDJSON_SSE42)
+    const char *SIMD_PATH = "sse4.2";
+#elif defined(RAPIDJSON_SSE2)
+    const char *SIMD_PATH = "sse2";
+#elif defined(RAPIDJSON_NEON)
+    const char *SIMD_PATH = "neon";
+#else
+    const char *SIMD_PATH = "none";
+#endif
+
+    // long classical titles are what actually push presence strings up against the 128 byte limits
+    const char *LONG_TITLE = "Symphonie Nr. 9 d-Moll, Op. 125 – IV. Presto – Allegro assai – "
+                             "„O Freunde, nicht diese Töne!“ – 交響曲第9番 ニ短調 – Симфония № 9";
+    const char *LONG_ARTIST = "Wiener Philharmoniker · Herbert von Karajan · Gundula Janowitz · "
+                              "Hilde Rössel-Majdan · Waldemar Kmentt · Walter Berry";
+    const char *FILE_URL = "D:\\Music\\Ludwig van Beethoven\\Symphonie Nr. 9 (Karajan, 1962)\\"
+                           "04 - IV. Presto - Allegro assai.flac";
+    const size_t COVER_BASE64_BYTES = 5 * 1024 * 1024;
+
+    std::u16string toUtf16(const std::string &utf8)
+    {
+        // fixtures only, so no validation
+        std::u16string out;
+        for (size_t i = 0; i < utf8.size();)
+        {
+            const unsigned char c = utf8[i];
+            uint32_t cp;
+            int extra;
+            if (c < 0x80)
+                cp = c, extra = 0;
+            else if (c < 0xE0)
+                cp = c & 0x1F, extra = 1;
+            else if (c < 0xF0)
+                cp = c & 0x0F, extra = 2;
+            else
+                cp = c & 0x07, extra = 3;
+            for (int k = 1; k <= extra; ++k)
+                cp = (cp << 6) | (utf8[i + k] & 0x3F);
+            i += extra + 1;
+
+            if (cp >= 0x10000)
+            {
+                out += static_cast<char16_t>(0xD800 + ((cp - 0x10000) >> 10));
+                out += static_cast<char16_t>(0xDC00 + ((cp - 0x10000) & 0x3FF));
+            }
+            else
+            {
+                out += static_cast<char16_t>(cp);
+            }
+        }
+        return out;
+    }
+
+    // laid out the way MusicBee writes it: [C# long capacity][int32 byteCount][UTF-16 LE]
+    std::vector<char> sharedView(const std::u16string &text, size_t offset)
+    {
+        const int32_t byteCount = static_cast<int32_t>(text.size() * sizeof(char16_t));
+        std::vector<char> view(offset + 8 + sizeof(byteCount) + byteCount);
+        memcpy(view.data() + offset + 8, &byteCount, sizeof(byteCount));
+        memcpy(view.data() + offset + 8 + sizeof(byteCount), text.data(), byteCount);
+        return view;
+    }
+
+    std::string inboundMessage()
+    {
+        // roughly what discord echoes back for SET_ACTIVITY, pretty printed so whitespace skipping
+        // gets exercised as well as string scanning
+        return std::string("{\n"
+                           "    \"cmd\": \"SET_ACTIVITY\",\n"
+                           "    \"data\": {\n"
+                           "        \"details\": \"♪ ") +
+               LONG_TITLE + "\",\n"
+                            "        \"state\": \"by " +
+               LONG_ARTIST + "\",\n"
+                             "        \"assets\": {\n"
+                             "            \"large_image\": \"music\",\n"
+                             "            \"large_text\": \"Listening to music\"\n"
+                             "        },\n"
+                             "        \"name\": \"DiscordMusicBee\",\n"
+                             "        \"application_id\": \"123456789012345678\",\n"
+                             "        \"type\": 0\n"
+                             "    },\n"
+                             "    \"evt\": null,\n"
+                             "    \"nonce\": \"42\"\n"
+                             "}";
+    }
+
+    void ipcBenchmarks(BenchSuite &suite)
+    {
+        const std::u16string title = toUtf16(std::string("♪ ") + LONG_TITLE);
+        const std::u16string url = toUtf16(FILE_URL);
+
+        const std::vector<char> titleView = sharedView(title, 24);
+        suite.Run("ipc.decode_shared_string/long_unicode_title", title.size() * 2, [&]()
+                  { KeepAlive(MusicBeeIPC::DecodeSharedString(titleView.data(), titleView.size(), 24)); });
+
+        const std::vector<char> urlView = sharedView(url, 24);
+        suite.Run("ipc.decode_shared_string/file_url", url.size() * 2, [&]()
+                  { KeepAlive(MusicBeeIPC::DecodeSharedString(urlView.data(), urlView.size(), 24)); });
+
+        // what getMusicBeeInfo does: onto the stack, then interned, which for a tag seen on the
+        // tick before is one lookup
+        InlineString<MusicInfo::TAG_BYTES> tag;
+        suite.Run("ipc.decode_shared_string/inline_title", title.size() * 2, [&]()
+                  {
+            tag.resize(MusicBeeIPC::DecodeSharedString(titleView.data(), titleView.size(), 24, tag.buffer(),
+                                                       MusicInfo::TAG_BYTES));
+            KeepAlive(tag); });
+
+        suite.Run("tag.intern/seen_title", 0, [&]()
+                  { KeepAlive(Tag(tag)); });
+
+        suite.Run("ipc.utf16_to_utf8/long_unicode_title", title.size() * 2, [&]()
+                  { KeepAlive(MusicBeeIPC::Utf16ToUtf8(title.data(), title.size())); });
+
+        suite.Run("ipc.utf16_to_utf8/ascii_url", url.size() * 2, [&]()
+                  { KeepAlive(MusicBeeIPC::Utf16ToUtf8(url.data(), url.size())); });
+    }
+
+    void presenceBenchmarks(BenchSuite &suite)
+    {
+        MusicInfo music;
+        music.isPlaying = true;
+        music.musicBeeRunning = true;
+        music.playState = MBPlayState::Playing;
+        music.title = Tag(LONG_TITLE);
+        music.artist = Tag(LONG_ARTIST);
+        music.fileUrl = Tag(FILE_URL);
+
+        PresenceText text;
+        DiscordRichPresence presence;
+        suite.Run("bridge.fill_presence", 0, [&]()
+                  {
+            fillPresence(music, text, presence);
+            KeepAlive(presence); });
+
+        // the same presence again, what a tag edit the presence doesn't show looks like to the tally
+        PresenceTally tally;
+        fillPresence(music, text, presence);
+        tally.Record(presence);
+        suite.Run("bridge.presence_tally/unchanged", 0, [&]()
+                  { KeepAlive(tally.Record(presence)); });
+
+        static char writeBuffer[16 * 1024];
+        const size_t written = JsonWriteRichPresenceObj(writeBuffer, sizeof(writeBuffer), 1, 1234, &presence);
+        suite.Run("json.write_rich_presence", written, [&]()
+                  { KeepAlive(JsonWriteRichPresenceObj(writeBuffer, sizeof(writeBuffer), 1, 1234, &presence)); });
+
+        // the send queue between Discord_UpdatePresence and the io thread, same element as discord_rpc.cpp
+        struct QueuedMessage
+        {
+            size_t length;
+            char buffer[16 * 1024];
+        };
+        static MsgQueue<QueuedMessage, 8> queue;
+        suite.Run("msgqueue.push_pop/presence", written, [&]()
+                  {
+            QueuedMessage *slot = queue.GetNextAddMessage();
+            slot->length = written;
+            memcpy(slot->buffer, writeBuffer, written);
+            queue.CommitAdd();
+
+            QueuedMessage *sent = queue.GetNextSendMessage();
+            KeepAlive(sent->buffer[sent->length - 1]);
+            queue.CommitSend(); });
+
+        const std::string inbound = inboundMessage();
+        std::vector<char> parseBuffer(inbound.size() + 1);
+        static JsonDocument document;
+        suite.Run("json.parse_inbound_insitu", inbound.size(), [&]()
+                  {
+            memcpy(parseBuffer.data(), inbound.c_str(), inbound.size() + 1);
+            document.Reset();
+            document.ParseInsitu(parseBuffer.data()); });
+    }
+
+#ifndef _WIN32
+    // RpcConnection::Read end to end: a fake discord on a unix socket in a temp dir writes a
+    // SET_ACTIVITY echo, the client reads the frame and parses it in place
+    void readFrameBenchmark(BenchSuite &suite)
+    {
+        char dir[] = "/tmp/dmb_bench_XXXXXX";
+        if (!mkdtemp(dir))
+            return;
+        setenv("XDG_RUNTIME_DIR", dir, 1);
+
+        const std::string socketPath = std::string(dir) + "/discord-ipc-0";
+        int server = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath.c_str());
+        if (server < 0 || bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(server, 1) != 0)
+        {
+            fprintf(stderr, "rpc.read_frame: no unix socket, skipped\n");
+            rmdir(dir);
+            return;
+        }
+
+        RpcConnection *rpc = RpcConnection::Create("123456789012345678");
+        int client = rpc->connection->Open() ? accept(server, nullptr, nullptr) : -1;
+        if (client >= 0)
+        {
+            // skip the handshake, the read path is the same either way
+            rpc->state = RpcConnection::State::Connected;
+
+            const std::string payload = inboundMessage();
+            std::vector<char> frame(sizeof(RpcConnection::MessageFrameHeader) + payload.size());
+            RpcConnection::MessageFrameHeader header{RpcConnection::Opcode::Frame, static_cast<uint32_t>(payload.size())};
+            memcpy(frame.data(), &header, sizeof(header));
+            memcpy(frame.data() + sizeof(header), payload.data(), payload.size());
+
+            JsonDocument &message = rpc->readDocument;
+            suite.Run("rpc.read_frame/set_activity_echo", frame.size(), [&]()
+                      {
+                send(client, frame.data(), frame.size(), 0);
+                KeepAlive(rpc->Read(message)); });
+            close(client);
+        }
+
+        RpcConnection::Destroy(rpc);
+        close(server);
+        unlink(socketPath.c_str());
+        rmdir(dir);
+    }
+#endif
+
+    // HistoryLog::Append once its strings are known, which is every play after an album's first:
+    // three lookups, a 40 byte record into the mapping and its checksum
+    void historyBenchmark(BenchSuite &suite)
+    {
+        const std::filesystem::path path = std::filesystem::temp_directory_path() / "dmb_bench_history.dmbh";
+        std::filesystem::remove(path);
+        HistoryLog history;
+        if (!history.Open(path.u8string()))
+        {
+            fprintf(stderr, "history.append: couldn't create %s, skipped\n", path.u8string().c_str());
+            return;
+        }
+
+        std::vector<Play> plays(1000);
+        for (size_t i = 0; i < plays.size(); ++i)
+        {
+            plays[i].startedAtMs = 1700000000000LL + static_cast<int64_t>(i) * 240000;
+            plays[i].listenedMs = 200000;
+            plays[i].durationMs = 240000;
+            plays[i].artist = Tag(std::string(LONG_ARTIST) + " " + std::to_string(i % 50));
+            plays[i].album = Tag("Symphonie Nr. " + std::to_string(i % 100));
+            plays[i].title = Tag(std::string(LONG_TITLE) + " " + std::to_string(i));
+        }
+        for (const Play &play : plays)
+            history.Append(play);
+
+        size_t next = 0;
+        suite.Run("history.append/interned", sizeof(PlayRecord), [&]()
+                  {
+            KeepAlive(history.Append(plays[next]));
+            next = (next + 1) % plays.size(); });
+
+        history.Close();
+        std::filesystem::remove(path);
+    }
+
+    // a poll tick where only the position moved, which is nearly every tick, through the sinks
+    // that take every one; Discord and the text file only see changes. Should be 0 allocs/op
+    void pipelineBenchmark(BenchSuite &suite)
+    {
+        const std::filesystem::path historyPath = std::filesystem::temp_directory_path() / "dmb_bench_pipeline.dmbh";
+        const std::filesystem::path textPath = std::filesystem::temp_directory_path() / "dmb_bench_now_playing.txt";
+        std::filesystem::remove(historyPath);
+        HistoryLog history;
+        if (!history.Open(historyPath.u8string()))
+        {
+            fprintf(stderr, "bridge.publish: couldn't create %s, skipped\n", historyPath.u8string().c_str());
+            return;
+        }
+
+        MusicInfo music;
+        music.isPlaying = true;
+        music.musicBeeRunning = true;
+        music.playState = MBPlayState::Playing;
+        music.title = Tag(LONG_TITLE);
+        music.artist = Tag(LONG_ARTIST);
+        music.album = Tag("Symphonie Nr. 9");
+        music.fileUrl = Tag(FILE_URL);
+        music.positionMs = 0;
+        music.durationMs = 24 * 60 * 1000;
+
+        MusicBeeIPC ipc;
+        {
+            PresencePipeline pipeline;
+            pipeline.Add(std::make_unique<HistorySink>(history));
+            pipeline.Add(std::make_unique<TextFileSink>(textPath.u8string()));
+            suite.Run("bridge.publish/unchanged_tick", 0, [&]()
+                      {
+                music.positionMs = (music.positionMs + 500) % music.durationMs;
+                KeepAlive(pipeline.Publish(music, ipc)); });
+        }
+
+        history.Close();
+        std::filesystem::remove(historyPath);
+        std::filesystem::remove(textPath);
+    }
+
+    // HistoryStats over a million plays (about four years of daily listening): building the
+    // columns, then the queries the window runs for the last week and over everything
+    void statsBenchmarks(BenchSuite &suite)
+    {
+        const int ARTISTS = 2000, ALBUMS_PER_ARTIST = 4, TRACKS_PER_ALBUM = 10;
+        const size_t PLAYS = 1000000;
+        const int64_t START_MS = 1600000000000LL, PLAY_GAP_MS = 126000;
+
+        std::vector<std::string> strings;
+        for (int i = 0; i < ARTISTS; ++i)
+            strings.push_back("Artist " + std::to_string(i));
+        for (int i = 0; i < ARTISTS * ALBUMS_PER_ARTIST; ++i)
+            strings.push_back("Album " + std::to_string(i));
+        for (int i = 0; i < ARTISTS * ALBUMS_PER_ARTIST * TRACKS_PER_ALBUM; ++i)
+            strings.push_back("Track " + std::to_string(i));
+
+        // favourites get most of the plays, and albums tend to be played through in order
+        std::vector<PlayRecord> plays(PLAYS);
+        uint32_t seed = 7;
+        int album = 0, track = 0;
+        for (size_t i = 0; i < PLAYS; ++i)
+        {
+            if (track == 0 || (seed >> 28) == 0)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                const double pick = (seed >> 8) / double(1u << 24);
+                album = static_cast<int>(pick * pick * pick * ARTISTS * ALBUMS_PER_ARTIST);
+            }
+            seed = seed * 1664525u + 1013904223u;
+            const int artist = album / ALBUMS_PER_ARTIST;
+            plays[i] = {START_MS + static_cast<int64_t>(i) * PLAY_GAP_MS, 180000 + static_cast<int32_t>(seed >> 16),
+                        240000, static_cast<uint32_t>(artist), static_cast<uint32_t>(ARTISTS + album),
+                        static_cast<uint32_t>(ARTISTS + ARTISTS * ALBUMS_PER_ARTIST + album * TRACKS_PER_ALBUM + track), 0};
+            track = (track + 1) % TRACKS_PER_ALBUM;
+        }
+
+        suite.Run("stats.build/1m_plays", PLAYS * sizeof(PlayRecord), [&]()
+                  {
+            HistoryStats built;
+            for (const PlayRecord &play : plays)
+                built.Add(play, strings);
+            KeepAlive(built.PlayCount()); });
+
+        HistoryStats stats;
+        for (const PlayRecord &play : plays)
+            stats.Add(play, strings);
+        const int64_t endMs = plays.back().startedAtMs + 1;
+        const int64_t weekMs = 7LL * 24 * 60 * 60 * 1000;
+
+        suite.Run("stats.top_artists/last_week_of_1m", 0, [&]()
+                  { KeepAlive(stats.TopArtists(endMs - weekMs, endMs, 10).size()); });
+        suite.Run("stats.top_tracks/last_week_of_1m", 0, [&]()
+                  { KeepAlive(stats.TopTracks(endMs - weekMs, endMs, 10).size()); });
+        suite.Run("stats.top_artists/all_1m", PLAYS * sizeof(uint32_t), [&]()
+                  { KeepAlive(stats.TopArtists(0, endMs, 10).size()); });
+        suite.Run("stats.top_tracks/all_1m", PLAYS * sizeof(uint32_t), [&]()
+                  { KeepAlive(stats.TopTracks(0, endMs, 10).size()); });
+        suite.Run("stats.listened/all_1m", PLAYS * sizeof(int32_t), [&]()
+                  { KeepAlive(stats.ListenedMs(0, endMs)); });
+    }
+
+    void artworkKeyBenchmark(BenchSuite &suite)
+    {
+        // GetArtwork hands back the base64 cover, hashed once per track for the artwork cache key
+        std::string cover(COVER_BASE64_BYTES, 'A');
+        uint32_t seed = 1;
+        const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (char &c : cover)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            c = alphabet[seed >> 26];
+        }
+        suite.Run("artwork.key_xxh64/5mb_base64", cover.size(), [&]()
+                  { KeepAlive(Xxh64(cover.data(), cover.size())); });
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchSuite suite(argc, argv);
+    suite.SetContext("rapidjson_simd", SIMD_PATH);
+#if defined(__clang__)
+    suite.SetContext("compiler", std::string("clang ") + __clang_version__);
+#elif defined(__GNUC__)
+    suite.SetContext("compiler", std::string("gcc ") + __VERSION__);
+#elif defined(_MSC_VER)
+    suite.SetContext("compiler", "msvc " + std::to_string(_MSC_VER));
+#endif
+#ifdef NDEBUG
+    suite.SetContext("assertions", "off");
+#else
+    suite.SetContext("assertions", "on");
+#endif
+
+    ipcBenchmarks(suite);
+    presenceBenchmarks(suite);
+#ifndef _WIN32
+    readFrameBenchmark(suite);
+#endif
+    historyBenchmark(suite);
+    pipelineBenchmark(suite);
+    statsBenchmarks(suite);
+    artworkKeyBenchmark(suite);
+#ifdef DMB_BENCH_QT
+    RunArtworkBenchmarks(suite);
+#endif
+
+    return suite.Finish();
+}
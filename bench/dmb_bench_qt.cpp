@@ -0,0 +1,61 @@
+// The artwork half of dmb_bench: what happens to a cover between GetArtwork and the label, with a
+// ~5 MB base64 cover like the ones MusicBee hands over for high resolution scans.
+#include <QBuffer>
+#include <QByteArray>
+#include <QImage>
+#include "artwork_loader.h"
+#include "bench.h"
+#include "cover_palette.h"
+
+namespace
+{
+    const int COVER_BASE64_BYTES = 5 * 1024 * 1024;
+
+    // noisy enough that jpeg can't squash it, grown until the base64 is about the size we want
+    QByteArray makeCoverJpeg()
+    {
+        QByteArray jpeg;
+        for (int size = 1000; jpeg.size() * 4 / 3 < COVER_BASE64_BYTES && size <= 4000; size += 500)
+        {
+            QImage image(size, size, QImage::Format_RGB32);
+            uint32_t seed = 7;
+            for (int y = 0; y < size; ++y)
+            {
+                uint32_t *line = reinterpret_cast<uint32_t *>(image.scanLine(y));
+                for (int x = 0; x < size; ++x)
+                {
+                    seed = seed * 1664525u + 1013904223u;
+                    line[x] = 0xFF000000u | (seed >> 8);
+                }
+            }
+
+            jpeg.clear();
+            QBuffer buffer(&jpeg);
+            buffer.open(QIODevice::WriteOnly);
+            image.save(&buffer, "JPEG", 95);
+        }
+        return jpeg;
+    }
+}
+
+void RunArtworkBenchmarks(BenchSuite &suite)
+{
+    const QByteArray jpeg = makeCoverJpeg();
+    const QByteArray base64 = jpeg.toBase64();
+
+    suite.Run("artwork.base64_decode/5mb", base64.size(), [&]()
+              { KeepAlive(QByteArray::fromBase64(base64)); });
+
+    suite.Run("artwork.decode_scale/5mb_jpeg_to_150", jpeg.size(), [&]()
+              { KeepAlive(decodeArtwork(jpeg, 150)); });
+
+    const QImage scaled = decodeArtwork(jpeg, 300);
+    const QImage cover150 = scaled.scaled(150, 150);
+    suite.Run("artwork.round_corners/150_r10", 0, [&]()
+              { KeepAlive(createRoundedImage(cover150, 10)); });
+    suite.Run("artwork.round_corners/300_r20", 0, [&]()
+              { KeepAlive(createRoundedImage(scaled, 20)); });
+
+    suite.Run("artwork.palette/150", 0, [&]()
+              { KeepAlive(extractPalette(cover150)); });
+}
@@ -0,0 +1,49 @@
+// Dominant colour histogram over covers of the sizes MusicBee hands over, from the 150px thumbnail
+// the worker actually feeds it up to full-size 3000x3000 scans.
+#include <QImage>
+#include <chrono>
+#include <cstdio>
+#include "cover_palette.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    QImage makeCover(int size)
+    {
+        // a few flat regions plus noise, roughly what album art looks like to a histogram
+        QImage image(size, size, QImage::Format_RGB32);
+        uint32_t seed = 12345;
+        for (int y = 0; y < size; ++y)
+        {
+            uint32_t *line = reinterpret_cast<uint32_t *>(image.scanLine(y));
+            for (int x = 0; x < size; ++x)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                const uint32_t base = (x < size / 2) ? 0xFF203060u : (y < size / 3 ? 0xFFD0A040u : 0xFF101010u);
+                line[x] = base ^ (seed >> 27);
+            }
+        }
+        return image;
+    }
+}
+
+int main()
+{
+    const int sizes[] = {150, 300, 1000, 3000};
+    for (int size : sizes)
+    {
+        const QImage cover = makeCover(size);
+        const int runs = size >= 1000 ? 20 : 500;
+
+        CoverPalette palette = extractPalette(cover);
+        const auto start = Clock::now();
+        for (int i = 0; i < runs; ++i)
+            palette = extractPalette(cover);
+        const double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / runs;
+
+        printf("%4dx%-4d %10.1f us/cover %8.1f Mpixel/s  dominant %s\n", size, size, us,
+               static_cast<double>(size) * size / us, qPrintable(palette.Dominant().name()));
+    }
+    return 0;
+}
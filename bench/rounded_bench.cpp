@@ -0,0 +1,72 @@
+// Rounding finished covers: the old per-image QPainter clip path against roundCorners' cached
+// corner mask, at the sizes the window uses on 100%, 150% and 200% displays.
+#include <QImage>
+#include <QPainter>
+#include <QPainterPath>
+#include <chrono>
+#include <cstdio>
+#include "rounded_mask.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const int RUNS = 2000;
+
+    QImage paintRoundedImage(const QImage &source, int radius)
+    {
+        QImage rounded(source.size(), QImage::Format_ARGB32_Premultiplied);
+        rounded.fill(Qt::transparent);
+
+        QPainter painter(&rounded);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+        QPainterPath path;
+        path.addRoundedRect(rounded.rect(), radius, radius);
+        painter.setClipPath(path);
+        painter.drawImage(0, 0, source);
+
+        return rounded;
+    }
+
+    QImage maskRoundedImage(const QImage &source, int radius)
+    {
+        QImage rounded = source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        roundCorners(rounded, radius);
+        return rounded;
+    }
+
+    template <typename Fn>
+    double microsecondsPerImage(const QImage &source, int radius, Fn round)
+    {
+        round(source, radius); // first call pays for the mask
+        const auto start = Clock::now();
+        qint64 sink = 0;
+        for (int i = 0; i < RUNS; ++i)
+            sink += round(source, radius).constBits()[0];
+        const double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / RUNS;
+        return sink < 0 ? 0 : us;
+    }
+}
+
+int main()
+{
+    const double scales[] = {1.0, 1.5, 2.0};
+    for (double scale : scales)
+    {
+        const int size = qRound(150 * scale);
+        const int radius = qRound(10 * scale);
+
+        QImage source(size, size, QImage::Format_RGB32);
+        for (int y = 0; y < size; ++y)
+            for (int x = 0; x < size; ++x)
+                source.setPixel(x, y, qRgb(x & 0xFF, y & 0xFF, (x * y) & 0xFF));
+
+        const double painted = microsecondsPerImage(source, radius, paintRoundedImage);
+        const double masked = microsecondsPerImage(source, radius, maskRoundedImage);
+        printf("%dx%d r%d (%.1fx): qpainter %8.1f us, mask %8.1f us, %.1fx faster\n",
+               size, size, radius, scale, painted, masked, painted / masked);
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+// Startup cost of the on-disk thumbnail cache: opening it (reading the url index) and getting the
+// first cover back for a known track, with a directory full of thumbnails from earlier runs.
+#include <QColor>
+#include <QImage>
+#include <QTemporaryDir>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include "thumbnail_disk_cache.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const int THUMBNAILS = 800;
+    const int SIZE = 150;
+    const int RUNS = 50;
+
+    double microsecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+
+    std::string trackUrl(int i)
+    {
+        return "C:\\Music\\Some Artist\\Some Album (Deluxe Edition)\\" + std::to_string(i) + " - Track.flac";
+    }
+}
+
+int main()
+{
+    QTemporaryDir dir;
+    if (!dir.isValid())
+        return 1;
+
+    {
+        ThumbnailDiskCache cache(dir.path(), 1024LL * 1024 * 1024);
+        for (int i = 0; i < THUMBNAILS; ++i)
+        {
+            // noisy enough that png can't squash it to nothing, like real covers
+            QImage image(SIZE, SIZE, QImage::Format_ARGB32_Premultiplied);
+            for (int y = 0; y < SIZE; ++y)
+                for (int x = 0; x < SIZE; ++x)
+                    image.setPixel(x, y, qRgb((x * 7 + i) & 0xFF, (y * 13 + i * 3) & 0xFF, (x * y + i) & 0xFF));
+            cache.Store(static_cast<uint64_t>(i) * 0x9E3779B97F4A7C15ULL + 1, trackUrl(i), image);
+        }
+    }
+
+    double openTotal = 0;
+    double firstCoverTotal = 0;
+    for (int run = 0; run < RUNS; ++run)
+    {
+        auto start = Clock::now();
+        auto cache = std::make_unique<ThumbnailDiskCache>(dir.path(), 1024LL * 1024 * 1024);
+        openTotal += microsecondsSince(start);
+
+        start = Clock::now();
+        uint64_t key = 0;
+        QImage image;
+        if (cache->FindKey(trackUrl(run * 13 % THUMBNAILS), &key))
+            image = cache->Load(key);
+        firstCoverTotal += microsecondsSince(start);
+
+        if (image.isNull())
+        {
+            std::printf("thumbnail missing\n");
+            return 1;
+        }
+    }
+
+    std::printf("thumbnails on disk            %10d\n", THUMBNAILS);
+    std::printf("open cache (index load)       %10.1f us\n", openTotal / RUNS);
+    std::printf("url -> first cover from disk  %10.1f us\n", firstCoverTotal / RUNS);
+    return 0;
+}
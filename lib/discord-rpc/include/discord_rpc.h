@@ -85,6 +85,30 @@ DISCORD_EXPORT void Discord_Respond(const char* userid, /* DISCORD_REPLY_ */ int
 
 DISCORD_EXPORT void Discord_UpdateHandlers(DiscordEventHandlers* handlers);
 
+/* optional client side ping, off (0) by default. after maxMissedPongs pings go unanswered the
+   connection is closed and reconnected. call after Discord_Initialize */
+DISCORD_EXPORT void Discord_SetHeartbeat(int intervalMs, int maxMissedPongs);
+/* round trip of the last answered ping and a smoothed average, -1 until one has been measured */
+DISCORD_EXPORT void Discord_GetHeartbeatRtt(int* lastRttMs, int* smoothedRttMs);
+/* handshakes completed and established connections lost since startup, and how long the last
+   handshake took from opening the pipe to READY (-1 until one has completed) */
+DISCORD_EXPORT void Discord_GetConnectionStats(int* connects, int* disconnects, int* lastConnectMs);
+/* events (ready, disconnects, errors, joins) dropped since startup because Discord_RunCallbacks
+   fell more than ~1000 events behind; up to that many are held and delivered in order */
+DISCORD_EXPORT int Discord_GetDroppedEvents(void);
+
+/* optional instrumentation, every member may be null. begin/end bracket work on the calling
+   thread (they nest), instant marks a point such as a presence being acknowledged. threadStarted
+   is called first thing on the io thread. call before Discord_Initialize */
+typedef struct DiscordTraceHooks {
+    void (*threadStarted)(const char* name);
+    void (*begin)(const char* name);
+    void (*end)(void);
+    void (*instant)(const char* name);
+} DiscordTraceHooks;
+
+DISCORD_EXPORT void Discord_SetTraceHooks(const DiscordTraceHooks* hooks);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
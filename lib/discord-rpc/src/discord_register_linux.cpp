@@ -21,6 +21,20 @@ static bool Mkdir(const char* path)
     return false;
 }
 
+static bool FileHasContents(const char* path, const char* contents, int length)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+
+    char existing[2048];
+    size_t existingLen = fread(existing, 1, sizeof(existing), fp);
+    bool atEnd = fgetc(fp) == EOF;
+    fclose(fp);
+    return atEnd && existingLen == (size_t)length && memcmp(existing, contents, length) == 0;
+}
+
 // we want to register games so we can run them from Discord client as discord-<appid>://
 extern "C" DISCORD_EXPORT void Discord_Register(const char* applicationId, const char* command)
 {
@@ -73,6 +87,11 @@ extern "C" DISCORD_EXPORT void Discord_Register(const char* applicationId, const
     }
     strcat(desktopFilePath, desktopFilename);
 
+    // written by an earlier launch: skip the rewrite and the xdg-mime fork
+    if (FileHasContents(desktopFilePath, desktopFile, fileLen)) {
+        return;
+    }
+
     FILE* fp = fopen(desktopFilePath, "w");
     if (fp) {
         fwrite(desktopFile, 1, fileLen, fp);
@@ -67,6 +67,30 @@ static LSTATUS regset(HKEY hkey,
     return ret;
 }
 
+// true if the value `name` under `subkey` already holds exactly this string
+static bool RegistryStringEquals(HKEY root,
+                                 const wchar_t* subkey,
+                                 const wchar_t* name,
+                                 const wchar_t* expected)
+{
+    HKEY key;
+    if (RegOpenKeyExW(root, subkey, 0, KEY_READ, &key) != ERROR_SUCCESS) {
+        return false;
+    }
+
+    wchar_t value[1024];
+    DWORD type = 0;
+    DWORD valueBytes = sizeof(value) - sizeof(wchar_t);
+    auto status = RegQueryValueExW(key, name, nullptr, &type, (BYTE*)value, &valueBytes);
+    RegCloseKey(key);
+    if (status != ERROR_SUCCESS || type != REG_SZ) {
+        return false;
+    }
+
+    value[valueBytes / sizeof(wchar_t)] = 0;
+    return lstrcmpW(value, expected) == 0;
+}
+
 static void Discord_RegisterW(const wchar_t* applicationId, const wchar_t* command)
 {
     // https://msdn.microsoft.com/en-us/library/aa767914(v=vs.85).aspx
@@ -94,6 +118,17 @@ static void Discord_RegisterW(const wchar_t* applicationId, const wchar_t* comma
 
     wchar_t keyName[256];
     StringCbPrintfW(keyName, sizeof(keyName), L"Software\\Classes\\%s", protocolName);
+
+    // already registered from this exe: two reads instead of rewriting the keys every launch
+    wchar_t commandKeyName[320];
+    StringCbPrintfW(commandKeyName, sizeof(commandKeyName), L"%s\\shell\\open\\command", keyName);
+    wchar_t iconKeyName[320];
+    StringCbPrintfW(iconKeyName, sizeof(iconKeyName), L"%s\\DefaultIcon", keyName);
+    if (RegistryStringEquals(HKEY_CURRENT_USER, commandKeyName, nullptr, openCommand) &&
+        RegistryStringEquals(HKEY_CURRENT_USER, iconKeyName, nullptr, exeFilePath)) {
+        return;
+    }
+
     HKEY key;
     auto status =
       RegCreateKeyExW(HKEY_CURRENT_USER, keyName, 0, nullptr, 0, KEY_WRITE, nullptr, &key, nullptr);
@@ -8,6 +8,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <deque>
 #include <mutex>
 
 #ifndef DISCORD_DISABLE_IO_THREAD
@@ -17,7 +18,9 @@
 
 constexpr size_t MaxMessageSize{16 * 1024};
 constexpr size_t MessageQueueSize{8};
-constexpr size_t JoinQueueSize{8};
+constexpr size_t CallbackQueueSize{64};
+// events held on the io side while the callback queue is full, ~800 bytes each
+constexpr size_t CallbackOverflowLimit{1024};
 
 struct QueuedMessage {
     size_t length;
@@ -46,27 +49,43 @@ struct User {
     // Rounded way up because I'm paranoid about games breaking from future changes in these sizes
 };
 
+// Everything the io thread wants to tell the callback thread goes through one queue, so events
+// come out in the order they happened and none of them overwrite each other between ticks.
+struct CallbackEvent {
+    enum class Type : int {
+        Ready,
+        Disconnected,
+        Errored,
+        JoinGame,
+        SpectateGame,
+        JoinRequest,
+    };
+
+    Type type;
+    int code;
+    // error message for Disconnected/Errored, secret for JoinGame/SpectateGame
+    char text[256];
+    // Ready/JoinRequest only
+    User user;
+};
+
 static RpcConnection* Connection{nullptr};
 static DiscordEventHandlers QueuedHandlers{};
 static DiscordEventHandlers Handlers{};
-static std::atomic_bool WasJustConnected{false};
-static std::atomic_bool WasJustDisconnected{false};
-static std::atomic_bool GotErrorMessage{false};
-static std::atomic_bool WasJoinGame{false};
-static std::atomic_bool WasSpectateGame{false};
 static std::atomic_bool UpdatePresence{false};
-static char JoinGameSecret[256];
-static char SpectateGameSecret[256];
-static int LastErrorCode{0};
-static char LastErrorMessage[256];
-static int LastDisconnectErrorCode{0};
-static char LastDisconnectErrorMessage[256];
 static std::mutex PresenceMutex;
 static std::mutex HandlerMutex;
 static QueuedMessage QueuedPresence{};
 static MsgQueue<QueuedMessage, MessageQueueSize> SendQueue;
-static MsgQueue<User, JoinQueueSize> JoinAskQueue;
-static User connectedUser;
+// produced only by the io thread (or whoever calls Discord_UpdateConnection), consumed only by
+// Discord_RunCallbacks
+static MsgQueue<CallbackEvent, CallbackQueueSize> CallbackQueue;
+// events the queue had no room for, oldest first, moved into it as Discord_RunCallbacks frees
+// slots; so a callback thread that falls behind loses nothing and sees nothing out of order.
+// only touched by the producer. past CallbackOverflowLimit an event is dropped and counted
+static std::deque<CallbackEvent> CallbackOverflow;
+static std::atomic_bool CallbackOverflowPending{false};
+static std::atomic_int DroppedCallbacks{0};
 
 // We want to auto connect, and retry on failure, but not as fast as possible. This does expoential
 // backoff from 0.5 seconds to 1 minute
@@ -74,6 +93,30 @@ static Backoff ReconnectTimeMs(500, 60 * 1000);
 static auto NextConnect = std::chrono::system_clock::now();
 static int Pid{0};
 static int Nonce{1};
+// set once before Discord_Initialize, read-only afterwards
+static DiscordTraceHooks TraceHooks{};
+
+struct TraceScope {
+    explicit TraceScope(const char* name)
+    {
+        if (TraceHooks.begin) {
+            TraceHooks.begin(name);
+        }
+    }
+    ~TraceScope()
+    {
+        if (TraceHooks.end) {
+            TraceHooks.end();
+        }
+    }
+};
+
+static void TraceInstant(const char* name)
+{
+    if (TraceHooks.instant) {
+        TraceHooks.instant(name);
+    }
+}
 
 #ifndef DISCORD_DISABLE_IO_THREAD
 static void Discord_UpdateConnection(void);
@@ -90,6 +133,9 @@ public:
         keepRunning.store(true);
         ioThread = std::thread([&]() {
             const std::chrono::duration<int64_t, std::milli> maxWait{500LL};
+            if (TraceHooks.threadStarted) {
+                TraceHooks.threadStarted("discord io");
+            }
             Discord_UpdateConnection();
             while (keepRunning.load()) {
                 std::unique_lock<std::mutex> lock(waitForIOMutex);
@@ -122,6 +168,64 @@ public:
 #endif // DISCORD_DISABLE_IO_THREAD
 static IoThreadHolder* IoThread{nullptr};
 
+// Moves whatever waited in CallbackOverflow into the queue, as far as it has room.
+static void FlushCallbackOverflow()
+{
+    while (!CallbackOverflow.empty()) {
+        auto slot = CallbackQueue.GetNextAddMessage();
+        if (!slot) {
+            break;
+        }
+        *slot = CallbackOverflow.front();
+        CallbackQueue.CommitAdd();
+        CallbackOverflow.pop_front();
+    }
+    CallbackOverflowPending.store(!CallbackOverflow.empty());
+}
+
+// Returns a zeroed event to fill in and hand to CommitCallbackEvent: a queue slot, or with the
+// queue full (or older events still waiting) one at the end of CallbackOverflow. nullptr only
+// once that is full as well.
+static CallbackEvent* BeginCallbackEvent(CallbackEvent::Type type)
+{
+    FlushCallbackOverflow();
+    CallbackEvent* event = nullptr;
+    if (CallbackOverflow.empty()) {
+        event = CallbackQueue.GetNextAddMessage();
+    }
+    if (!event) {
+        if (CallbackOverflow.size() >= CallbackOverflowLimit) {
+            ++DroppedCallbacks;
+            return nullptr;
+        }
+        CallbackOverflow.emplace_back();
+        event = &CallbackOverflow.back();
+    }
+    event->type = type;
+    event->code = 0;
+    event->text[0] = 0;
+    event->user = {};
+    return event;
+}
+
+static void CommitCallbackEvent(CallbackEvent* event)
+{
+    if (!CallbackOverflow.empty() && event == &CallbackOverflow.back()) {
+        CallbackOverflowPending.store(true);
+    }
+    else {
+        CallbackQueue.CommitAdd();
+    }
+}
+
+static void CopyUser(User& dest, JsonValue* user)
+{
+    StringCopy(dest.userId, GetStrMember(user, "id"));
+    StringCopy(dest.username, GetStrMember(user, "username"));
+    StringCopy(dest.discriminator, GetStrMember(user, "discriminator"));
+    StringCopy(dest.avatar, GetStrMember(user, "avatar"));
+}
+
 static void UpdateReconnectTime()
 {
     NextConnect = std::chrono::system_clock::now() +
@@ -137,19 +241,21 @@ static void Discord_UpdateConnection(void)
     if (!Connection) {
         return;
     }
+    TraceScope wake("io.update");
+    FlushCallbackOverflow();
 
     if (!Connection->IsOpen()) {
         if (std::chrono::system_clock::now() >= NextConnect) {
+            TraceScope connect("io.connect");
             UpdateReconnectTime();
             Connection->Open();
         }
     }
     else {
-        // reads
-
+        // reads, all parsed into the connection's reusable document
+        JsonDocument& message = Connection->readDocument;
         for (;;) {
-            JsonDocument message;
-
+            TraceScope read("io.read");
             if (!Connection->Read(message)) {
                 break;
             }
@@ -161,10 +267,20 @@ static void Discord_UpdateConnection(void)
                 // in responses only -- should use to match up response when needed.
 
                 if (evtName && strcmp(evtName, "ERROR") == 0) {
+                    TraceInstant("discord.error");
                     auto data = GetObjMember(&message, "data");
-                    LastErrorCode = GetIntMember(data, "code");
-                    StringCopy(LastErrorMessage, GetStrMember(data, "message", ""));
-                    GotErrorMessage.store(true);
+                    auto event = BeginCallbackEvent(CallbackEvent::Type::Errored);
+                    if (event) {
+                        event->code = GetIntMember(data, "code");
+                        StringCopy(event->text, GetStrMember(data, "message", ""));
+                        CommitCallbackEvent(event);
+                    }
+                }
+                else if (TraceHooks.instant) {
+                    const char* cmd = GetStrMember(&message, "cmd");
+                    if (cmd && strcmp(cmd, "SET_ACTIVITY") == 0) {
+                        TraceInstant("discord.ack");
+                    }
                 }
             }
             else {
@@ -177,45 +293,45 @@ static void Discord_UpdateConnection(void)
 
                 if (strcmp(evtName, "ACTIVITY_JOIN") == 0) {
                     auto secret = GetStrMember(data, "secret");
-                    if (secret) {
-                        StringCopy(JoinGameSecret, secret);
-                        WasJoinGame.store(true);
+                    auto event =
+                      secret ? BeginCallbackEvent(CallbackEvent::Type::JoinGame) : nullptr;
+                    if (event) {
+                        StringCopy(event->text, secret);
+                        CommitCallbackEvent(event);
                     }
                 }
                 else if (strcmp(evtName, "ACTIVITY_SPECTATE") == 0) {
                     auto secret = GetStrMember(data, "secret");
-                    if (secret) {
-                        StringCopy(SpectateGameSecret, secret);
-                        WasSpectateGame.store(true);
+                    auto event =
+                      secret ? BeginCallbackEvent(CallbackEvent::Type::SpectateGame) : nullptr;
+                    if (event) {
+                        StringCopy(event->text, secret);
+                        CommitCallbackEvent(event);
                     }
                 }
                 else if (strcmp(evtName, "ACTIVITY_JOIN_REQUEST") == 0) {
                     auto user = GetObjMember(data, "user");
                     auto userId = GetStrMember(user, "id");
                     auto username = GetStrMember(user, "username");
-                    auto avatar = GetStrMember(user, "avatar");
-                    auto joinReq = JoinAskQueue.GetNextAddMessage();
-                    if (userId && username && joinReq) {
-                        StringCopy(joinReq->userId, userId);
-                        StringCopy(joinReq->username, username);
-                        auto discriminator = GetStrMember(user, "discriminator");
-                        if (discriminator) {
-                            StringCopy(joinReq->discriminator, discriminator);
-                        }
-                        if (avatar) {
-                            StringCopy(joinReq->avatar, avatar);
-                        }
-                        else {
-                            joinReq->avatar[0] = 0;
-                        }
-                        JoinAskQueue.CommitAdd();
+                    auto event = (userId && username)
+                      ? BeginCallbackEvent(CallbackEvent::Type::JoinRequest)
+                      : nullptr;
+                    if (event) {
+                        CopyUser(event->user, user);
+                        CommitCallbackEvent(event);
                     }
                 }
             }
         }
 
+        Connection->Heartbeat();
+        if (!Connection->IsOpen()) {
+            return;
+        }
+
         // writes
         if (UpdatePresence.exchange(false) && QueuedPresence.length) {
+            TraceScope write("io.write_presence");
             QueuedMessage local;
             {
                 std::lock_guard<std::mutex> guard(PresenceMutex);
@@ -230,6 +346,7 @@ static void Discord_UpdateConnection(void)
         }
 
         while (SendQueue.HavePendingSends()) {
+            TraceScope write("io.write");
             auto qmessage = SendQueue.GetNextSendMessage();
             Connection->Write(qmessage->buffer, qmessage->length);
             SendQueue.CommitSend();
@@ -317,30 +434,22 @@ extern "C" DISCORD_EXPORT void Discord_Initialize(const char* applicationId,
         }
         auto data = GetObjMember(&readyMessage, "data");
         auto user = GetObjMember(data, "user");
-        auto userId = GetStrMember(user, "id");
-        auto username = GetStrMember(user, "username");
-        auto avatar = GetStrMember(user, "avatar");
-        if (userId && username) {
-            StringCopy(connectedUser.userId, userId);
-            StringCopy(connectedUser.username, username);
-            auto discriminator = GetStrMember(user, "discriminator");
-            if (discriminator) {
-                StringCopy(connectedUser.discriminator, discriminator);
-            }
-            if (avatar) {
-                StringCopy(connectedUser.avatar, avatar);
-            }
-            else {
-                connectedUser.avatar[0] = 0;
+        auto event = BeginCallbackEvent(CallbackEvent::Type::Ready);
+        if (event) {
+            if (GetStrMember(user, "id") && GetStrMember(user, "username")) {
+                CopyUser(event->user, user);
             }
+            CommitCallbackEvent(event);
         }
-        WasJustConnected.exchange(true);
         ReconnectTimeMs.reset();
     };
     Connection->onDisconnect = [](int err, const char* message) {
-        LastDisconnectErrorCode = err;
-        StringCopy(LastDisconnectErrorMessage, message);
-        WasJustDisconnected.exchange(true);
+        auto event = BeginCallbackEvent(CallbackEvent::Type::Disconnected);
+        if (event) {
+            event->code = err;
+            StringCopy(event->text, message);
+            CommitCallbackEvent(event);
+        }
         UpdateReconnectTime();
     };
 
@@ -363,11 +472,20 @@ extern "C" DISCORD_EXPORT void Discord_Shutdown(void)
         IoThread = nullptr;
     }
 
+    // nothing produces any more; what's left was meant for these handlers, not the next ones
+    while (CallbackQueue.HavePendingSends()) {
+        CallbackQueue.GetNextSendMessage();
+        CallbackQueue.CommitSend();
+    }
+    CallbackOverflow.clear();
+    CallbackOverflowPending.store(false);
+
     RpcConnection::Destroy(Connection);
 }
 
 extern "C" DISCORD_EXPORT void Discord_UpdatePresence(const DiscordRichPresence* presence)
 {
+    TraceScope scope("Discord_UpdatePresence");
     {
         std::lock_guard<std::mutex> guard(PresenceMutex);
         QueuedPresence.length = JsonWriteRichPresenceObj(
@@ -399,80 +517,117 @@ extern "C" DISCORD_EXPORT void Discord_Respond(const char* userId, /* DISCORD_RE
 
 extern "C" DISCORD_EXPORT void Discord_RunCallbacks(void)
 {
-    // Note on some weirdness: internally we might connect, get other signals, disconnect any number
-    // of times inbetween calls here. Externally, we want the sequence to seem sane, so any other
-    // signals are book-ended by calls to ready and disconnect.
+    TraceScope scope("Discord_RunCallbacks");
+    // Events are delivered exactly in the order the io thread saw them, so a ready/disconnect pair
+    // that happened between two calls here comes out as ready then disconnected, with anything
+    // that arrived while connected in between. Join requests are still delivered in a burst as
+    // before; it should be trivial for the implementer to queue them up themselves.
 
-    if (!Connection) {
+    if (!Connection || !CallbackQueue.HavePendingSends()) {
         return;
     }
 
-    bool wasDisconnected = WasJustDisconnected.exchange(false);
-    bool isConnected = Connection->IsOpen();
-
-    if (isConnected) {
-        // if we are connected, disconnect cb first
+    // take a copy so the handlers are free to call Discord_UpdateHandlers themselves
+    DiscordEventHandlers handlers;
+    {
         std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (wasDisconnected && Handlers.disconnected) {
-            Handlers.disconnected(LastDisconnectErrorCode, LastDisconnectErrorMessage);
-        }
+        handlers = Handlers;
     }
 
-    if (WasJustConnected.exchange(false)) {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (Handlers.ready) {
-            DiscordUser du{connectedUser.userId,
-                           connectedUser.username,
-                           connectedUser.discriminator,
-                           connectedUser.avatar};
-            Handlers.ready(&du);
+    while (CallbackQueue.HavePendingSends()) {
+        auto event = CallbackQueue.GetNextSendMessage();
+        DiscordUser du{
+          event->user.userId, event->user.username, event->user.discriminator, event->user.avatar};
+
+        switch (event->type) {
+        case CallbackEvent::Type::Ready:
+            if (handlers.ready) {
+                handlers.ready(&du);
+            }
+            break;
+        case CallbackEvent::Type::Disconnected:
+            if (handlers.disconnected) {
+                handlers.disconnected(event->code, event->text);
+            }
+            break;
+        case CallbackEvent::Type::Errored:
+            if (handlers.errored) {
+                handlers.errored(event->code, event->text);
+            }
+            break;
+        case CallbackEvent::Type::JoinGame:
+            if (handlers.joinGame) {
+                handlers.joinGame(event->text);
+            }
+            break;
+        case CallbackEvent::Type::SpectateGame:
+            if (handlers.spectateGame) {
+                handlers.spectateGame(event->text);
+            }
+            break;
+        case CallbackEvent::Type::JoinRequest:
+            if (handlers.joinRequest) {
+                handlers.joinRequest(&du);
+            }
+            break;
         }
+
+        CallbackQueue.CommitSend();
     }
 
-    if (GotErrorMessage.exchange(false)) {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (Handlers.errored) {
-            Handlers.errored(LastErrorCode, LastErrorMessage);
-        }
+    // the io thread would get to the rest on its next wake anyway, this saves waiting for it
+    if (CallbackOverflowPending.load()) {
+        SignalIOActivity();
     }
+}
 
-    if (WasJoinGame.exchange(false)) {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (Handlers.joinGame) {
-            Handlers.joinGame(JoinGameSecret);
-        }
+extern "C" DISCORD_EXPORT void Discord_SetHeartbeat(int intervalMs, int maxMissedPongs)
+{
+    if (!Connection) {
+        return;
     }
+    Connection->heartbeatIntervalMs.store(intervalMs > 0 ? intervalMs : 0);
+    Connection->heartbeatMaxMissed.store(maxMissedPongs > 0 ? maxMissedPongs : 1);
+    SignalIOActivity();
+}
 
-    if (WasSpectateGame.exchange(false)) {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (Handlers.spectateGame) {
-            Handlers.spectateGame(SpectateGameSecret);
-        }
+extern "C" DISCORD_EXPORT void Discord_GetConnectionStats(int* connects,
+                                                          int* disconnects,
+                                                          int* lastConnectMs)
+{
+    if (connects) {
+        *connects = Connection ? Connection->connects.load() : 0;
+    }
+    if (disconnects) {
+        *disconnects = Connection ? Connection->disconnects.load() : 0;
+    }
+    if (lastConnectMs) {
+        *lastConnectMs = Connection ? Connection->lastConnectMs.load() : -1;
     }
+}
 
-    // Right now this batches up any requests and sends them all in a burst; I could imagine a world
-    // where the implementer would rather sequentially accept/reject each one before the next invite
-    // is sent. I left it this way because I could also imagine wanting to process these all and
-    // maybe show them in one common dialog and/or start fetching the avatars in parallel, and if
-    // not it should be trivial for the implementer to make a queue themselves.
-    while (JoinAskQueue.HavePendingSends()) {
-        auto req = JoinAskQueue.GetNextSendMessage();
-        {
-            std::lock_guard<std::mutex> guard(HandlerMutex);
-            if (Handlers.joinRequest) {
-                DiscordUser du{req->userId, req->username, req->discriminator, req->avatar};
-                Handlers.joinRequest(&du);
-            }
-        }
-        JoinAskQueue.CommitSend();
+extern "C" DISCORD_EXPORT int Discord_GetDroppedEvents(void)
+{
+    return DroppedCallbacks.load();
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetTraceHooks(const DiscordTraceHooks* hooks)
+{
+    if (hooks) {
+        TraceHooks = *hooks;
+    }
+    else {
+        TraceHooks = {};
     }
+}
 
-    if (!isConnected) {
-        // if we are not connected, disconnect message last
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (wasDisconnected && Handlers.disconnected) {
-            Handlers.disconnected(LastDisconnectErrorCode, LastDisconnectErrorMessage);
-        }
+extern "C" DISCORD_EXPORT void Discord_GetHeartbeatRtt(int* lastRttMs, int* smoothedRttMs)
+{
+    if (lastRttMs) {
+        *lastRttMs = Connection ? Connection->lastRttMs.load() : -1;
+    }
+    if (smoothedRttMs) {
+        *smoothedRttMs = Connection ? Connection->smoothedRttMs.load() : -1;
     }
 }
 
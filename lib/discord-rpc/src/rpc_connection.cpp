@@ -2,6 +2,8 @@
 #include "serialization.h"
 
 #include <atomic>
+#include <cstdlib>
+#include <new>
 
 static const int RpcVersion = 1;
 static RpcConnection Instance;
@@ -17,6 +19,9 @@ static RpcConnection Instance;
 {
     c->Close();
     BaseConnection::Destroy(c->connection);
+    delete[] c->readBuffer;
+    c->readBuffer = nullptr;
+    c->readBufferSize = 0;
     c = nullptr;
 }
 
@@ -26,17 +31,25 @@ void RpcConnection::Open()
         return;
     }
 
-    if (state == State::Disconnected && !connection->Open()) {
-        return;
+    if (state == State::Disconnected) {
+        connectStarted = std::chrono::steady_clock::now();
+        if (!connection->Open()) {
+            return;
+        }
+        ResetHeartbeat();
     }
 
     if (state == State::SentHandshake) {
-        JsonDocument message;
+        JsonDocument& message = readDocument;
         if (Read(message)) {
             auto cmd = GetStrMember(&message, "cmd");
             auto evt = GetStrMember(&message, "evt");
             if (cmd && evt && !strcmp(cmd, "DISPATCH") && !strcmp(evt, "READY")) {
                 state = State::Connected;
+                lastConnectMs.store((int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                                      std::chrono::steady_clock::now() - connectStarted)
+                                      .count());
+                ++connects;
                 if (onConnect) {
                     onConnect(message);
                 }
@@ -59,6 +72,9 @@ void RpcConnection::Open()
 
 void RpcConnection::Close()
 {
+    if (state == State::Connected) {
+        ++disconnects;
+    }
     if (onDisconnect && (state == State::Connected || state == State::SentHandshake)) {
         onDisconnect(lastErrorCode, lastErrorMessage);
     }
@@ -78,14 +94,33 @@ bool RpcConnection::Write(const void* data, size_t length)
     return true;
 }
 
+char* RpcConnection::ReserveReadBuffer(size_t size)
+{
+    if (size <= readBufferSize) {
+        return readBuffer;
+    }
+    size_t newSize = readBufferSize ? readBufferSize : MinRpcReadBufferSize;
+    while (newSize < size) {
+        newSize *= 2;
+    }
+    char* newBuffer = new (std::nothrow) char[newSize];
+    if (!newBuffer) {
+        return nullptr;
+    }
+    delete[] readBuffer;
+    readBuffer = newBuffer;
+    readBufferSize = newSize;
+    return readBuffer;
+}
+
 bool RpcConnection::Read(JsonDocument& message)
 {
     if (state != State::Connected && state != State::SentHandshake) {
         return false;
     }
-    MessageFrame readFrame;
     for (;;) {
-        bool didRead = connection->Read(&readFrame, sizeof(MessageFrameHeader));
+        MessageFrameHeader header;
+        bool didRead = connection->Read(&header, sizeof(MessageFrameHeader));
         if (!didRead) {
             if (!connection->isOpen) {
                 lastErrorCode = (int)ErrorCode::PipeClosed;
@@ -95,35 +130,53 @@ bool RpcConnection::Read(JsonDocument& message)
             return false;
         }
 
-        if (readFrame.length > 0) {
-            didRead = connection->Read(readFrame.message, readFrame.length);
+        // room for the header, the payload and a null terminator for the in place parse
+        const size_t frameSize = sizeof(MessageFrameHeader) + header.length;
+        char* frame = header.length < MaxRpcFrameSize - sizeof(MessageFrameHeader)
+          ? ReserveReadBuffer(frameSize + 1)
+          : nullptr;
+        if (!frame) {
+            lastErrorCode = (int)ErrorCode::ReadCorrupt;
+            StringCopy(lastErrorMessage, "Frame too large");
+            Close();
+            return false;
+        }
+        memcpy(frame, &header, sizeof(MessageFrameHeader));
+        char* payload = frame + sizeof(MessageFrameHeader);
+
+        if (header.length > 0) {
+            didRead = connection->Read(payload, header.length);
             if (!didRead) {
                 lastErrorCode = (int)ErrorCode::ReadCorrupt;
                 StringCopy(lastErrorMessage, "Partial data in frame");
                 Close();
                 return false;
             }
-            readFrame.message[readFrame.length] = 0;
         }
+        payload[header.length] = 0;
 
-        switch (readFrame.opcode) {
+        switch (header.opcode) {
         case Opcode::Close: {
-            message.ParseInsitu(readFrame.message);
+            message.Reset();
+            message.ParseInsitu(payload);
             lastErrorCode = GetIntMember(&message, "code");
             StringCopy(lastErrorMessage, GetStrMember(&message, "message", ""));
             Close();
             return false;
         }
         case Opcode::Frame:
-            message.ParseInsitu(readFrame.message);
+            message.Reset();
+            message.ParseInsitu(payload);
             return true;
         case Opcode::Ping:
-            readFrame.opcode = Opcode::Pong;
-            if (!connection->Write(&readFrame, sizeof(MessageFrameHeader) + readFrame.length)) {
+            header.opcode = Opcode::Pong;
+            memcpy(frame, &header, sizeof(MessageFrameHeader));
+            if (!connection->Write(frame, frameSize)) {
                 Close();
             }
             break;
         case Opcode::Pong:
+            OnPong(payload);
             break;
         case Opcode::Handshake:
         default:
@@ -135,3 +188,75 @@ bool RpcConnection::Read(JsonDocument& message)
         }
     }
 }
+
+void RpcConnection::ResetHeartbeat()
+{
+    awaitingPong = false;
+    missedPongs = 0;
+    lastPingSent = std::chrono::steady_clock::now();
+}
+
+void RpcConnection::Heartbeat()
+{
+    const int intervalMs = heartbeatIntervalMs.load();
+    if (intervalMs <= 0 || state != State::Connected) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastPingSent < std::chrono::milliseconds(intervalMs)) {
+        return;
+    }
+
+    if (awaitingPong && ++missedPongs >= heartbeatMaxMissed.load()) {
+        // the pipe can stay half open for a long time without a write failing, so drop it here
+        // and let the reconnect logic bring it back
+        lastErrorCode = (int)ErrorCode::HeartbeatTimeout;
+        StringCopy(lastErrorMessage, "Heartbeat timed out");
+        Close();
+        return;
+    }
+
+    // the server echoes the ping payload back in its pong, so a sequence number as the nonce is
+    // enough to match them up. it has to be json: the client parses every frame body
+    char frame[sizeof(MessageFrameHeader) + 64];
+    MessageFrameHeader ping{Opcode::Ping, 0};
+    ping.length = (uint32_t)JsonWritePing(
+      frame + sizeof(MessageFrameHeader), sizeof(frame) - sizeof(MessageFrameHeader), ++pingSequence);
+    memcpy(frame, &ping, sizeof(ping));
+    if (!connection->Write(frame, sizeof(MessageFrameHeader) + ping.length)) {
+        Close();
+        return;
+    }
+    lastPingSent = now;
+    awaitingPong = true;
+}
+
+void RpcConnection::OnPong(char* payload)
+{
+    // any pong means the other end is alive, even a late one for an older ping
+    missedPongs = 0;
+    if (!awaitingPong) {
+        return;
+    }
+
+    // parsed rather than compared byte for byte, the server may write the json back its own way
+    readDocument.Reset();
+    readDocument.ParseInsitu(payload);
+    const char* nonce = !readDocument.HasParseError() && readDocument.IsObject()
+      ? GetStrMember(&readDocument, "nonce")
+      : nullptr;
+    if (!nonce || strtol(nonce, nullptr, 10) != pingSequence) {
+        return;
+    }
+    awaitingPong = false;
+
+    auto rtt = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - lastPingSent);
+    const int rttMs = (int)rtt.count();
+    lastRttMs.store(rttMs);
+
+    // same 1/8 gain TCP uses for its smoothed rtt
+    const int smoothed = smoothedRttMs.load();
+    smoothedRttMs.store(smoothed < 0 ? rttMs : smoothed + (rttMs - smoothed) / 8);
+}
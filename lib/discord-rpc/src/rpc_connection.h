@@ -3,15 +3,22 @@
 #include "connection.h"
 #include "serialization.h"
 
+#include <atomic>
+#include <chrono>
+
 // I took this from the buffer size libuv uses for named pipes; I suspect ours would usually be much
 // smaller.
 constexpr size_t MaxRpcFrameSize = 64 * 1024;
+// Inbound frames are read into a buffer that starts this big and doubles as needed, up to
+// MaxRpcFrameSize.
+constexpr size_t MinRpcReadBufferSize = 1024;
 
 struct RpcConnection {
     enum class ErrorCode : int {
         Success = 0,
         PipeClosed = 1,
         ReadCorrupt = 2,
+        HeartbeatTimeout = 3,
     };
 
     enum class Opcode : uint32_t {
@@ -46,6 +53,30 @@ struct RpcConnection {
     int lastErrorCode{0};
     char lastErrorMessage[256]{};
     RpcConnection::MessageFrame sendFrame;
+    // Per connection arena for inbound messages: frames are read into readBuffer (header then
+    // payload, sized to the largest frame seen so far) and parsed in place into readDocument,
+    // both of which are reused for every message.
+    char* readBuffer{nullptr};
+    size_t readBufferSize{0};
+    JsonDocument readDocument;
+
+    // Optional client side heartbeat; an interval of 0 leaves it off and we only answer the
+    // server's pings. Settings are written by the app thread, everything else is io thread only
+    // except the rtt values which are read back by the app.
+    std::atomic_int heartbeatIntervalMs{0};
+    std::atomic_int heartbeatMaxMissed{3};
+    std::atomic_int lastRttMs{-1};
+    std::atomic_int smoothedRttMs{-1};
+    std::chrono::steady_clock::time_point lastPingSent{};
+    int pingSequence{0};
+    bool awaitingPong{false};
+    int missedPongs{0};
+
+    // connection health, written by the io thread and read back by the app
+    std::atomic_int connects{0};
+    std::atomic_int disconnects{0};
+    std::atomic_int lastConnectMs{-1};
+    std::chrono::steady_clock::time_point connectStarted{};
 
     static RpcConnection* Create(const char* applicationId);
     static void Destroy(RpcConnection*&);
@@ -56,4 +87,8 @@ struct RpcConnection {
     void Close();
     bool Write(const void* data, size_t length);
     bool Read(JsonDocument& message);
+    void Heartbeat();
+    void ResetHeartbeat();
+    void OnPong(char* payload);
+    char* ReserveReadBuffer(size_t size);
 };
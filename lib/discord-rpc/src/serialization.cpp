@@ -2,6 +2,15 @@
 #include "connection.h"
 #include "discord_rpc.h"
 
+#include <string.h>
+
+// Discord rejects the whole activity if one of the text fields is over this, so rather than waste
+// a write (and a rate limit slot) on it we cut them down here.
+constexpr size_t MaxPresenceTextBytes = 128;
+// U+2026 HORIZONTAL ELLIPSIS
+constexpr char Ellipsis[] = "\xE2\x80\xA6";
+constexpr size_t EllipsisBytes = sizeof(Ellipsis) - 1;
+
 template <typename T>
 void NumberToString(char* dest, T number)
 {
@@ -72,6 +81,102 @@ void WriteOptionalString(JsonWriter& w, T& k, const char* value)
     }
 }
 
+// Runs of ASCII are skipped eight bytes at a time.
+size_t Utf8ValidPrefixLength(const char* str, size_t length)
+{
+    auto bytes = (const unsigned char*)str;
+    size_t i = 0;
+    while (i < length) {
+        if (length - i >= sizeof(uint64_t)) {
+            uint64_t chunk;
+            memcpy(&chunk, bytes + i, sizeof(chunk));
+            if ((chunk & 0x8080808080808080ULL) == 0) {
+                i += sizeof(chunk);
+                continue;
+            }
+        }
+
+        const unsigned char lead = bytes[i];
+        size_t sequenceLength;
+        uint32_t codepoint;
+        if (lead < 0x80) {
+            ++i;
+            continue;
+        }
+        else if (lead >= 0xC2 && lead <= 0xDF) {
+            sequenceLength = 2;
+            codepoint = lead & 0x1F;
+        }
+        else if (lead >= 0xE0 && lead <= 0xEF) {
+            sequenceLength = 3;
+            codepoint = lead & 0x0F;
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4) {
+            sequenceLength = 4;
+            codepoint = lead & 0x07;
+        }
+        else {
+            // stray continuation byte, overlong 2 byte lead, or out of range
+            return i;
+        }
+
+        if (length - i < sequenceLength) {
+            return i;
+        }
+        for (size_t j = 1; j < sequenceLength; ++j) {
+            if ((bytes[i + j] & 0xC0) != 0x80) {
+                return i;
+            }
+            codepoint = (codepoint << 6) | (bytes[i + j] & 0x3F);
+        }
+        // overlong 3/4 byte forms, surrogates, past U+10FFFF
+        const bool overlong = (sequenceLength == 3 && codepoint < 0x800) ||
+          (sequenceLength == 4 && codepoint < 0x10000);
+        const bool surrogate = codepoint >= 0xD800 && codepoint <= 0xDFFF;
+        if (overlong || surrogate || codepoint > 0x10FFFF) {
+            return i;
+        }
+        i += sequenceLength;
+    }
+    return i;
+}
+
+// Like WriteOptionalString, but never writes more than MaxPresenceTextBytes of UTF-8. Anything that doesn't
+// fit, or isn't valid UTF-8, is dropped at a code point boundary and replaced with an ellipsis.
+template <typename T>
+void WriteOptionalText(JsonWriter& w, T& k, const char* value)
+{
+    constexpr size_t maxBytes = MaxPresenceTextBytes;
+    if (!value || !value[0]) {
+        return;
+    }
+
+    // only need to know whether there is anything past maxBytes, not the full length
+    auto terminator = (const char*)memchr(value, 0, maxBytes + 1);
+    const size_t length = terminator ? (size_t)(terminator - value) : maxBytes + 1;
+    size_t valid = Utf8ValidPrefixLength(value, length < maxBytes ? length : maxBytes);
+    if (valid == length) {
+        w.Key(k, sizeof(T) - 1);
+        w.String(value, (rapidjson::SizeType)valid);
+        return;
+    }
+
+    // valid is already on a code point boundary; step back over continuation bytes if we need
+    // to give up more room for the ellipsis
+    if (valid > maxBytes - EllipsisBytes) {
+        valid = maxBytes - EllipsisBytes;
+        while (valid > 0 && ((unsigned char)value[valid] & 0xC0) == 0x80) {
+            --valid;
+        }
+    }
+
+    char truncated[maxBytes];
+    memcpy(truncated, value, valid);
+    memcpy(truncated + valid, Ellipsis, EllipsisBytes);
+    w.Key(k, sizeof(T) - 1);
+    w.String(truncated, (rapidjson::SizeType)(valid + EllipsisBytes));
+}
+
 static void JsonWriteNonce(JsonWriter& writer, int nonce)
 {
     WriteKey(writer, "nonce");
@@ -80,6 +185,18 @@ static void JsonWriteNonce(JsonWriter& writer, int nonce)
     writer.String(nonceBuffer);
 }
 
+size_t JsonWritePing(char* dest, size_t maxLen, int nonce)
+{
+    JsonWriter writer(dest, maxLen);
+
+    {
+        WriteObject obj(writer);
+        JsonWriteNonce(writer, nonce);
+    }
+
+    return writer.Size();
+}
+
 size_t JsonWriteRichPresenceObj(char* dest,
                                 size_t maxLen,
                                 int nonce,
@@ -105,8 +222,8 @@ size_t JsonWriteRichPresenceObj(char* dest,
             if (presence != nullptr) {
                 WriteObject activity(writer, "activity");
 
-                WriteOptionalString(writer, "state", presence->state);
-                WriteOptionalString(writer, "details", presence->details);
+                WriteOptionalText(writer, "state", presence->state);
+                WriteOptionalText(writer, "details", presence->details);
 
                 if (presence->startTimestamp || presence->endTimestamp) {
                     WriteObject timestamps(writer, "timestamps");
@@ -128,9 +245,9 @@ size_t JsonWriteRichPresenceObj(char* dest,
                     (presence->smallImageText && presence->smallImageText[0])) {
                     WriteObject assets(writer, "assets");
                     WriteOptionalString(writer, "large_image", presence->largeImageKey);
-                    WriteOptionalString(writer, "large_text", presence->largeImageText);
+                    WriteOptionalText(writer, "large_text", presence->largeImageText);
                     WriteOptionalString(writer, "small_image", presence->smallImageKey);
-                    WriteOptionalString(writer, "small_text", presence->smallImageText);
+                    WriteOptionalText(writer, "small_text", presence->smallImageText);
                 }
 
                 if ((presence->partyId && presence->partyId[0]) || presence->partySize ||
@@ -36,8 +36,14 @@ inline size_t StringCopy(char (&dest)[Len], const char* src)
     return copied - 1;
 }
 
+// Length of the longest prefix of str[0, length) made only of complete, valid UTF-8 sequences.
+size_t Utf8ValidPrefixLength(const char* str, size_t length);
+
 size_t JsonWriteHandshakeObj(char* dest, size_t maxLen, int version, const char* applicationId);
 
+// the body of a heartbeat ping, {"nonce":"<nonce>"}; the client parses frame bodies as json
+size_t JsonWritePing(char* dest, size_t maxLen, int nonce);
+
 // Commands
 struct DiscordRichPresence;
 size_t JsonWriteRichPresenceObj(char* dest,
@@ -106,6 +112,8 @@ public:
     {
     }
     static const bool kNeedFree = false;
+    // hand the whole buffer out again; only safe once nothing allocated from it is still in use
+    void Reset() { buffer_ = fixedBuffer_; }
 };
 
 // wonder why this isn't a thing already, maybe I missed it
@@ -175,6 +183,17 @@ public:
       , stackAllocator_()
     {
     }
+
+    // Drops the previous message and rewinds both allocators to the start of their buffers, so
+    // one document can be reused for every message instead of building a new one each time.
+    // Anything that spilled past parseBuffer_ into malloc'd chunks is released here. The parse
+    // stack is always empty between parses, so its allocator can be rewound too.
+    void Reset()
+    {
+        SetObject();
+        poolAllocator_.Clear();
+        stackAllocator_.Reset();
+    }
 };
 
 using JsonValue = rapidjson::GenericValue<UTF8, PoolAllocator>;
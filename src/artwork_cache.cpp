@@ -0,0 +1,61 @@
+#include "artwork_cache.h"
+#include "xxhash64.h"
+
+ArtworkCache::ArtworkCache(size_t budgetBytes) : images(static_cast<qsizetype>(budgetBytes))
+{
+}
+
+uint64_t ArtworkCache::Key(const void *data, size_t length, uint64_t seed)
+{
+    return Xxh64(data, length, seed);
+}
+
+const QImage *ArtworkCache::Find(uint64_t key)
+{
+    // QCache::object moves the entry to the front, which is the LRU bookkeeping we want
+    const QImage *image = images.object(key);
+    if (image)
+        ++stats.hits;
+    else
+        ++stats.misses;
+    return image;
+}
+
+void ArtworkCache::Insert(uint64_t key, const QImage &image)
+{
+    if (image.isNull())
+        return;
+
+    const qsizetype countBefore = images.count();
+    const bool replacing = images.contains(key);
+    // takes ownership, and deletes straight away if the image alone is over budget
+    bool inserted = images.insert(key, new QImage(image), image.sizeInBytes());
+    CountEvictions(countBefore - (replacing ? 1 : 0), inserted);
+}
+
+void ArtworkCache::SetBudget(size_t budgetBytes)
+{
+    const qsizetype countBefore = images.count();
+    images.setMaxCost(static_cast<qsizetype>(budgetBytes));
+    CountEvictions(countBefore, false);
+}
+
+void ArtworkCache::Clear()
+{
+    images.clear();
+}
+
+ArtworkCache::Stats ArtworkCache::GetStats() const
+{
+    Stats current = stats;
+    current.bytes = static_cast<size_t>(images.totalCost());
+    current.entries = static_cast<size_t>(images.count());
+    return current;
+}
+
+void ArtworkCache::CountEvictions(qsizetype countBefore, bool inserted)
+{
+    const qsizetype expected = countBefore + (inserted ? 1 : 0);
+    if (images.count() < expected)
+        stats.evictions += static_cast<uint64_t>(expected - images.count());
+}
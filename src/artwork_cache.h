@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QCache>
+#include <QImage>
+#include <cstddef>
+#include <cstdint>
+
+// Finished (scaled and rounded) artwork keyed by a hash of the raw artwork data, least recently
+// used first out once the byte budget is reached. GUI thread only.
+class ArtworkCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+
+    explicit ArtworkCache(size_t budgetBytes);
+
+    // seed keeps renderings of the same data at different sizes apart
+    static uint64_t Key(const void *data, size_t length, uint64_t seed = 0);
+
+    // nullptr on a miss; the image stays owned by the cache
+    const QImage *Find(uint64_t key);
+    void Insert(uint64_t key, const QImage &image);
+    void SetBudget(size_t budgetBytes);
+    void Clear();
+
+    Stats GetStats() const;
+
+private:
+    // QCache counts cost in qsizetype, we use bytes
+    QCache<uint64_t, QImage> images;
+    Stats stats;
+
+    void CountEvictions(qsizetype countBefore, bool inserted);
+};
@@ -0,0 +1,100 @@
+#include "artwork_loader.h"
+#include <QBuffer>
+#include <QImageReader>
+#include "cover_palette.h"
+#include "rounded_mask.h"
+#include "trace.h"
+
+QImage decodeArtwork(const QByteArray &imageData, int size)
+{
+    QBuffer buffer;
+    buffer.setData(imageData);
+    QImageReader reader(&buffer);
+
+    // let the codec do the bulk of the downscale where it can (jpeg decodes straight to a
+    // fraction of the size), a 3000x3000 cover never gets expanded to full resolution
+    QSize sourceSize = reader.size();
+    if (sourceSize.isValid() && (sourceSize.width() > size || sourceSize.height() > size))
+        reader.setScaledSize(sourceSize.scaled(size, size, Qt::KeepAspectRatio));
+
+    QImage image = reader.read();
+    if (image.isNull())
+        return image;
+
+    if (image.width() > size || image.height() > size)
+        image = image.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return image;
+}
+
+QImage createRoundedImage(const QImage &source, int radius)
+{
+    QImage rounded = source;
+    roundCorners(rounded, radius);
+    return rounded;
+}
+
+ArtworkLoader::ArtworkLoader(QObject *parent) : QObject(parent)
+{
+    // one decode at a time; a newer request makes the older one bail out anyway
+    pool.setMaxThreadCount(1);
+}
+
+ArtworkLoader::~ArtworkLoader()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+void ArtworkLoader::request(quint64 key, std::shared_ptr<const std::string> image, int size, int radius, qreal devicePixelRatio)
+{
+    const quint64 id = ++generation;
+
+    pool.start([this, id, key, image, size, radius, devicePixelRatio]()
+               {
+        if (!isCurrent(id))
+            return;
+        traceThreadName("artwork");
+        TraceSpan span("artwork.load");
+
+        // decoded and rounded in device pixels, so it's sharp on scaled displays. the bytes are
+        // read in place, image keeps them alive until the decode is done
+        QImage scaled;
+        {
+            TraceSpan step("artwork.decode");
+            const QByteArray imageData = QByteArray::fromRawData(image->data(), static_cast<qsizetype>(image->size()));
+            scaled = decodeArtwork(imageData, qRound(size * devicePixelRatio));
+        }
+
+        QImage rounded;
+        if (!scaled.isNull() && isCurrent(id))
+        {
+            // once per decoded cover, riding along with it into both caches
+            CoverPalette palette;
+            {
+                TraceSpan step("artwork.palette");
+                palette = extractPalette(scaled);
+            }
+            TraceSpan step("artwork.round");
+            rounded = createRoundedImage(scaled, qRound(radius * devicePixelRatio));
+            attachPalette(rounded, palette);
+            rounded.setDevicePixelRatio(devicePixelRatio);
+        }
+
+        if (!isCurrent(id))
+            return;
+
+        // hand back on the GUI thread, checking again in case a newer track came in meanwhile
+        QMetaObject::invokeMethod(this, [this, id, key, rounded]()
+                                  {
+            if (!isCurrent(id))
+                return;
+            if (rounded.isNull())
+                emit artworkFailed();
+            else
+                emit artworkReady(key, rounded); }, Qt::QueuedConnection); });
+}
+
+void ArtworkLoader::cancel()
+{
+    ++generation;
+}
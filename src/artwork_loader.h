@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QObject>
+#include <QImage>
+#include <QByteArray>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+#include <string>
+
+// Decodes, scales and rounds cover art off the GUI thread. Only QImage is used on the worker since
+// QPixmap belongs to the GUI thread; the caller converts the result.
+class ArtworkLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ArtworkLoader(QObject *parent = nullptr);
+    ~ArtworkLoader() override;
+
+    // Queues the cover's image file bytes (the pipeline's NowPlaying::Derived::artwork, shared
+    // rather than copied) to be decoded to fit size x size with rounded corners; key is handed
+    // back with the result. size and radius are logical pixels, the image comes back at
+    // devicePixelRatio. Anything still in flight for an earlier request is abandoned at its next
+    // stage and never reported.
+    void request(quint64 key, std::shared_ptr<const std::string> image, int size, int radius, qreal devicePixelRatio);
+    void cancel();
+
+signals:
+    void artworkReady(quint64 key, const QImage &image);
+    void artworkFailed();
+
+private:
+    QThreadPool pool;
+    std::atomic<quint64> generation{0};
+
+    bool isCurrent(quint64 id) const { return generation.load() == id; }
+};
+
+// image data in any format Qt reads, decoded to fit size x size (the codec does most of the
+// downscale where it can, so huge covers are never expanded to full resolution)
+QImage decodeArtwork(const QByteArray &imageData, int size);
+
+// copy of source with its corners rounded, radius in the source's pixels
+QImage createRoundedImage(const QImage &source, int radius);
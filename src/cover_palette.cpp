@@ -0,0 +1,154 @@
+#include "cover_palette.h"
+#include <QCoreApplication>
+#include <QStringList>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DMB_PALETTE_SSE2
+#endif
+
+namespace
+{
+    const int BUCKETS = 1 << 12;
+    const int MIN_BUCKET_DISTANCE = 3; // summed over channels, in 4-bit steps
+    const char *PALETTE_KEY = "dmb-palette";
+
+    // top 4 bits of r, g, b of a 0xAARRGGBB pixel
+    inline uint32_t bucketOf(uint32_t pixel)
+    {
+        return ((pixel >> 12) & 0xF00) | ((pixel >> 8) & 0x0F0) | ((pixel >> 4) & 0x00F);
+    }
+
+    void countRow(const uint32_t *pixels, int width, uint32_t *counts)
+    {
+        int x = 0;
+#ifdef DMB_PALETTE_SSE2
+        // four bucket indices per step; alpha >= 128 is just the top bit, read off with one movemask
+        const __m128i redMask = _mm_set1_epi32(0xF00);
+        const __m128i greenMask = _mm_set1_epi32(0x0F0);
+        const __m128i blueMask = _mm_set1_epi32(0x00F);
+        alignas(16) uint32_t buckets[4];
+        for (; x + 4 <= width; x += 4)
+        {
+            const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + x));
+            const __m128i index = _mm_or_si128(
+                _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 12), redMask), _mm_and_si128(_mm_srli_epi32(p, 8), greenMask)),
+                _mm_and_si128(_mm_srli_epi32(p, 4), blueMask));
+            _mm_store_si128(reinterpret_cast<__m128i *>(buckets), index);
+
+            const int opaque = _mm_movemask_ps(_mm_castsi128_ps(p));
+            if (opaque == 0xF)
+            {
+                ++counts[buckets[0]];
+                ++counts[buckets[1]];
+                ++counts[buckets[2]];
+                ++counts[buckets[3]];
+            }
+            else
+            {
+                for (int i = 0; i < 4; ++i)
+                {
+                    if (opaque & (1 << i))
+                        ++counts[buckets[i]];
+                }
+            }
+        }
+#endif
+        for (; x < width; ++x)
+        {
+            if (pixels[x] >= 0x80000000u)
+                ++counts[bucketOf(pixels[x])];
+        }
+    }
+
+    int bucketDistance(int a, int b)
+    {
+        return std::abs((a >> 8) - (b >> 8)) + std::abs(((a >> 4) & 0xF) - ((b >> 4) & 0xF)) + std::abs((a & 0xF) - (b & 0xF));
+    }
+
+    QColor bucketColour(int bucket)
+    {
+        // middle of the bucket
+        return QColor(((bucket >> 8) << 4) | 8, (((bucket >> 4) & 0xF) << 4) | 8, ((bucket & 0xF) << 4) | 8);
+    }
+}
+
+CoverPalette extractPalette(const QImage &image)
+{
+    CoverPalette palette;
+    if (image.isNull())
+        return palette;
+
+    // checked in release builds too: a 3000px scan would stall the window for tens of
+    // milliseconds. the cover just goes without an accent, and whoever called it hears about it
+    const QCoreApplication *app = QCoreApplication::instance();
+    if (app && QThread::currentThread() == app->thread())
+    {
+        static std::atomic<bool> warned{false};
+        if (!warned.exchange(true))
+            qWarning("palette: extractPalette called on the GUI thread, it belongs on the artwork worker; no palette");
+        return palette;
+    }
+
+    // 0xAARRGGBB in memory for both; anything else (indexed, 16-bit, ...) is converted first
+    QImage pixels = image;
+    if (pixels.format() != QImage::Format_RGB32 && pixels.format() != QImage::Format_ARGB32)
+        pixels = pixels.convertToFormat(QImage::Format_ARGB32);
+
+    std::vector<uint32_t> counts(BUCKETS, 0);
+    for (int y = 0; y < pixels.height(); ++y)
+        countRow(reinterpret_cast<const uint32_t *>(pixels.constScanLine(y)), pixels.width(), counts.data());
+
+    std::vector<int> order(BUCKETS);
+    for (int i = 0; i < BUCKETS; ++i)
+        order[i] = i;
+    std::partial_sort(order.begin(), order.begin() + 64, order.end(), [&counts](int a, int b)
+                      { return counts[a] > counts[b]; });
+
+    int chosen[CoverPalette::MAX_COLOURS];
+    for (int i = 0; i < 64 && palette.count < CoverPalette::MAX_COLOURS; ++i)
+    {
+        const int bucket = order[i];
+        if (counts[bucket] == 0)
+            break;
+
+        bool distinct = true;
+        for (int j = 0; j < palette.count && distinct; ++j)
+            distinct = bucketDistance(bucket, chosen[j]) >= MIN_BUCKET_DISTANCE;
+        if (!distinct)
+            continue;
+
+        chosen[palette.count] = bucket;
+        palette.colours[palette.count++] = bucketColour(bucket);
+    }
+    return palette;
+}
+
+void attachPalette(QImage &image, const CoverPalette &palette)
+{
+    QStringList names;
+    for (int i = 0; i < palette.count; ++i)
+        names << palette.colours[i].name();
+    image.setText(PALETTE_KEY, names.join(','));
+}
+
+CoverPalette paletteOf(const QImage &image)
+{
+    CoverPalette palette;
+    const QStringList names = image.text(PALETTE_KEY).split(',', Qt::SkipEmptyParts);
+    for (const QString &name : names)
+    {
+        if (palette.count == CoverPalette::MAX_COLOURS)
+            break;
+        QColor colour(name);
+        if (colour.isValid())
+            palette.colours[palette.count++] = colour;
+    }
+    return palette;
+}
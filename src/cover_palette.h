@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QColor>
+#include <QImage>
+
+// Colours picked from a cover for theming, most common first. Computed once per decoded cover on
+// the artwork worker (never on the GUI thread) and carried in the image's text metadata, so the
+// memory and disk caches keep it along with the pixels.
+struct CoverPalette
+{
+    static constexpr int MAX_COLOURS = 4;
+
+    QColor colours[MAX_COLOURS];
+    int count = 0;
+
+    QColor Dominant() const { return count ? colours[0] : QColor(); }
+};
+
+// one pass over the pixels into a 12-bit (4 per channel) colour histogram, ignoring mostly
+// transparent pixels; the busiest buckets that aren't near each other become the palette.
+// Refuses to run on the application's main thread, in every build: the palette comes back empty
+// and a warning is logged once
+CoverPalette extractPalette(const QImage &image);
+
+void attachPalette(QImage &image, const CoverPalette &palette);
+// empty for images cached before they carried one
+CoverPalette paletteOf(const QImage &image);
@@ -0,0 +1,27 @@
+#include "presence_bridge.h"
+#include "history_stats.h"
+#include "metrics.h"
+#include "overlay_server.h"
+#include "presence_sinks.h"
+#include <cstdio>
+#include <cstring>
+#include "startup_trace.h"
+#include "trace.h"
+
+// DiscordMusicBeeHeadless: the presence bridge on its own, no Qt linked
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--stats") == 0)
+            return printHistoryStats(HistoryLog::PathFromArgs(argc, argv));
+    }
+
+    markStartup("main");
+    startTraceFromArgs(argc, argv);
+    if (!startMetricsFromArgs(argc, argv))
+        fprintf(stderr, "metrics: couldn't listen on the given address\n");
+    if (!startOverlayFromArgs(argc, argv))
+        fprintf(stderr, "overlay: couldn't listen on the given address\n");
+    return runHeadless(HistoryLog::PathFromArgs(argc, argv), TextFileSink::PathFromArgs(argc, argv));
+}
@@ -0,0 +1,460 @@
+#include "history_log.h"
+#include "xxhash64.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char FILE_MAGIC[8] = {'D', 'M', 'B', 'H', 'I', 'S', 'T', 1}; // last byte is the version
+    const size_t FILE_HEADER_BYTES = 16;                                // magic, creation time
+    const size_t RECORD_HEADER_BYTES = 8;
+    const size_t MIN_CAPACITY = 64 * 1024;
+    const uint32_t NO_STRING = UINT32_MAX; // in tagStringIds, a tag not appended yet
+
+    const uint16_t KIND_END = 0; // zeroed space past the last record
+    const uint16_t KIND_STRING = 1;
+    const uint16_t KIND_PLAY = 2;
+
+    struct RecordHeader
+    {
+        uint16_t kind;
+        uint16_t length; // payload bytes
+        uint32_t checksum;
+    };
+    static_assert(sizeof(RecordHeader) == RECORD_HEADER_BYTES, "the on-disk record header");
+
+    size_t recordBytes(size_t length)
+    {
+        return (RECORD_HEADER_BYTES + length + 7) & ~size_t(7);
+    }
+
+    uint32_t checksum(uint16_t kind, const void *payload, size_t length)
+    {
+        return static_cast<uint32_t>(Xxh64(payload, length, (static_cast<uint64_t>(kind) << 16) | length));
+    }
+
+    // cut at a byte limit without splitting a utf-8 sequence
+    size_t clippedLength(std::string_view text, size_t limit)
+    {
+        if (text.size() <= limit)
+            return text.size();
+        size_t length = limit;
+        while (length > 0 && (static_cast<unsigned char>(text[length]) & 0xC0) == 0x80)
+            --length;
+        return length;
+    }
+
+    std::string environment(const char *name)
+    {
+        const char *value = std::getenv(name);
+        return value ? value : "";
+    }
+}
+
+HistoryLog::~HistoryLog()
+{
+    Close();
+}
+
+bool HistoryLog::Open(const std::string &path, bool readOnly)
+{
+    Close();
+    this->readOnly = readOnly;
+
+    const std::filesystem::path filePath = std::filesystem::u8path(path);
+    std::error_code error;
+    if (filePath.has_parent_path() && !readOnly)
+        std::filesystem::create_directories(filePath.parent_path(), error);
+
+    // one writer at a time (the window and the headless build both log); readers don't mind
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE handle = readOnly ? CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr)
+                             : CreateFileW(filePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                                           OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+    file = handle;
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(handle, &fileSize))
+        size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    file = readOnly ? ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC) : ::open(filePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (file < 0)
+        return false;
+    if (!readOnly && flock(file, LOCK_EX | LOCK_NB) != 0)
+    {
+        ::close(file);
+        file = -1;
+        return false;
+    }
+    struct stat info;
+    if (fstat(file, &info) == 0)
+        size = static_cast<size_t>(info.st_size);
+#endif
+
+    if (readOnly)
+    {
+        if (size < FILE_HEADER_BYTES || !Map(size) || !Recover())
+        {
+            Unmap();
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    // an existing file is mapped as it is until it's known to be ours
+    if (!Map(size ? size : MIN_CAPACITY))
+    {
+        Close();
+        return false;
+    }
+
+    // a crash before the header reached the disk leaves a file of zeros, start that one over
+    const unsigned char blank[FILE_HEADER_BYTES] = {};
+    if (size == 0 || (size >= FILE_HEADER_BYTES && memcmp(base, blank, sizeof(blank)) == 0))
+    {
+        const int64_t createdAtMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                        std::chrono::system_clock::now().time_since_epoch())
+                                        .count();
+        memcpy(base, FILE_MAGIC, sizeof(FILE_MAGIC));
+        memcpy(base + sizeof(FILE_MAGIC), &createdAtMs, sizeof(createdAtMs));
+        end = FILE_HEADER_BYTES;
+    }
+    else if (!Recover())
+    {
+        // not ours (or a newer version); leave it alone rather than overwrite it
+        Unmap();
+        Close();
+        return false;
+    }
+
+    syncedTo = 0;
+    lastSync = std::chrono::steady_clock::now() - FLUSH_INTERVAL;
+    return true;
+}
+
+void HistoryLog::Close()
+{
+    if (base)
+    {
+        Flush();
+        Unmap();
+    }
+    if (readOnly)
+        end = 0; // nothing to trim
+
+#ifdef _WIN32
+    if (file)
+    {
+        // the mapping grew the file ahead of what's written; trim it back
+        LARGE_INTEGER size;
+        size.QuadPart = static_cast<LONGLONG>(end);
+        if (end && SetFilePointerEx(static_cast<HANDLE>(file), size, nullptr, FILE_BEGIN))
+            SetEndOfFile(static_cast<HANDLE>(file));
+        CloseHandle(static_cast<HANDLE>(file));
+        file = nullptr;
+    }
+#else
+    if (file >= 0)
+    {
+        // the mapping grew the file ahead of what's written; trim it back. if that fails the
+        // zeroed tail is only skipped again on the next open
+        if (end && ftruncate(file, static_cast<off_t>(end)) != 0)
+            perror("history");
+        ::close(file);
+        file = -1;
+    }
+#endif
+
+    end = 0;
+    syncedTo = 0;
+    readOnly = false;
+    playCount = 0;
+    strings.clear();
+    stringIds.clear();
+    tagStringIds.clear();
+}
+
+bool HistoryLog::Append(const Play &play)
+{
+    if (!base || readOnly)
+        return false;
+
+    bool ok = true;
+    PlayRecord record;
+    record.startedAtMs = play.startedAtMs;
+    record.listenedMs = play.listenedMs;
+    record.durationMs = play.durationMs;
+    record.artistId = Intern(play.artist, &ok);
+    record.albumId = Intern(play.album, &ok);
+    record.titleId = Intern(play.title, &ok);
+    record.reserved = 0;
+    if (!ok || !Reserve(recordBytes(sizeof(record))))
+        return false;
+
+    WriteRecord(KIND_PLAY, &record, sizeof(record));
+    ++playCount;
+
+    if (std::chrono::steady_clock::now() - lastSync >= FLUSH_INTERVAL)
+        Flush();
+    return true;
+}
+
+bool HistoryLog::Flush()
+{
+    if (!base || readOnly || syncedTo == end)
+        return base != nullptr;
+
+#ifdef _WIN32
+    const size_t from = syncedTo; // rounded down to its page by FlushViewOfFile
+    const bool ok = FlushViewOfFile(base + from, end - from) && FlushFileBuffers(static_cast<HANDLE>(file));
+#else
+    // msync wants a page aligned start; the first page may already be partly synced
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t from = syncedTo & ~(page - 1);
+    const bool ok = msync(base + from, end - from, MS_SYNC) == 0;
+#endif
+    if (ok)
+        syncedTo = end;
+    lastSync = std::chrono::steady_clock::now();
+    return ok;
+}
+
+size_t HistoryLog::ForEachPlay(const std::function<void(const PlayRecord &)> &fn, size_t cursor) const
+{
+    size_t offset = cursor > FILE_HEADER_BYTES ? cursor : FILE_HEADER_BYTES;
+    while (offset < end)
+    {
+        RecordHeader header;
+        memcpy(&header, base + offset, sizeof(header));
+        if (header.kind == KIND_PLAY)
+        {
+            PlayRecord record;
+            memcpy(&record, base + offset + RECORD_HEADER_BYTES, sizeof(record));
+            fn(record);
+        }
+        offset += recordBytes(header.length);
+    }
+    return offset;
+}
+
+std::string HistoryLog::DefaultPath()
+{
+#ifdef _WIN32
+    const std::string root = environment("LOCALAPPDATA");
+#else
+    std::string root = environment("XDG_DATA_HOME");
+    if (root.empty() && !environment("HOME").empty())
+        root = environment("HOME") + "/.local/share";
+#endif
+    if (root.empty())
+        return "";
+    return root + "/DiscordMusicBee/history.dmbh";
+}
+
+std::string HistoryLog::PathFromArgs(int argc, char *argv[])
+{
+    std::string path;
+    bool given = false;
+    for (int i = 1; i + 1 < argc && !given; ++i)
+    {
+        if (strcmp(argv[i], "--history") == 0)
+        {
+            path = argv[i + 1];
+            given = true;
+        }
+    }
+    if (!given && std::getenv("DMB_HISTORY"))
+    {
+        path = environment("DMB_HISTORY");
+        given = true;
+    }
+
+    if (!given)
+        return DefaultPath();
+    return path == "off" ? "" : path;
+}
+
+bool HistoryLog::Map(size_t size)
+{
+#ifdef _WIN32
+    LARGE_INTEGER fileSize;
+    fileSize.QuadPart = static_cast<LONGLONG>(size);
+    mapping = CreateFileMappingW(static_cast<HANDLE>(file), nullptr, readOnly ? PAGE_READONLY : PAGE_READWRITE,
+                                 fileSize.HighPart, fileSize.LowPart, nullptr);
+    if (!mapping)
+        return false;
+    base = static_cast<unsigned char *>(MapViewOfFile(static_cast<HANDLE>(mapping), readOnly ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, size));
+    if (!base)
+    {
+        CloseHandle(static_cast<HANDLE>(mapping));
+        mapping = nullptr;
+        return false;
+    }
+#else
+    // the file has to be as long as the mapping; the new space reads as zeros
+    struct stat info;
+    if (fstat(file, &info) != 0)
+        return false;
+    if (!readOnly && static_cast<size_t>(info.st_size) < size && ftruncate(file, static_cast<off_t>(size)) != 0)
+        return false;
+    void *view = mmap(nullptr, size, readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (view == MAP_FAILED)
+        return false;
+    base = static_cast<unsigned char *>(view);
+#endif
+    capacity = size;
+    return true;
+}
+
+void HistoryLog::Unmap()
+{
+    if (!base)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(static_cast<HANDLE>(mapping));
+    mapping = nullptr;
+#else
+    munmap(base, capacity);
+#endif
+    base = nullptr;
+    capacity = 0;
+}
+
+bool HistoryLog::Reserve(size_t bytes)
+{
+    if (end + bytes <= capacity)
+        return true;
+
+    // doubling keeps remaps rare; CreateFileMapping extends the file on windows, ftruncate here
+    size_t grown = capacity * 2;
+    while (grown < end + bytes)
+        grown *= 2;
+    Unmap();
+    return Map(grown);
+}
+
+bool HistoryLog::Recover()
+{
+    if (capacity < FILE_HEADER_BYTES || memcmp(base, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+        return false;
+
+    size_t offset = FILE_HEADER_BYTES;
+    while (offset + RECORD_HEADER_BYTES <= capacity)
+    {
+        RecordHeader header;
+        memcpy(&header, base + offset, sizeof(header));
+        const size_t total = recordBytes(header.length);
+        if (header.kind == KIND_END || offset + total > capacity)
+            break;
+
+        const unsigned char *payload = base + offset + RECORD_HEADER_BYTES;
+        if (checksum(header.kind, payload, header.length) != header.checksum)
+            break; // torn by a crash mid-append
+
+        if (header.kind == KIND_STRING)
+        {
+            uint32_t id;
+            if (header.length < sizeof(id))
+                break;
+            memcpy(&id, payload, sizeof(id));
+            if (id != strings.size())
+                break;
+            strings.emplace_back(reinterpret_cast<const char *>(payload) + sizeof(id), header.length - sizeof(id));
+            stringIds.emplace(strings.back(), id);
+        }
+        else if (header.kind == KIND_PLAY)
+        {
+            PlayRecord record;
+            if (header.length != sizeof(record))
+                break;
+            memcpy(&record, payload, sizeof(record));
+            if (record.artistId >= strings.size() || record.albumId >= strings.size() || record.titleId >= strings.size())
+                break;
+            ++playCount;
+        }
+        else
+        {
+            break;
+        }
+        offset += total;
+    }
+    end = offset;
+    if (readOnly)
+        return true;
+
+    // whatever a crash left past the last good record is cleared, so nothing appended later can
+    // line up with a stale record behind it
+    for (size_t i = end; i < capacity; ++i)
+    {
+        if (base[i])
+        {
+            memset(base + end, 0, capacity - end);
+            break;
+        }
+    }
+    return true;
+}
+
+uint32_t HistoryLog::Intern(const Tag &tag, bool *ok)
+{
+    // an artist or album played before in this session: an index, not a hash of the text
+    if (tag.Id() < tagStringIds.size() && tagStringIds[tag.Id()] != NO_STRING)
+        return tagStringIds[tag.Id()];
+
+    const std::string text(tag.view().substr(0, clippedLength(tag.view(), MAX_STRING_BYTES)));
+    uint32_t id;
+    const auto found = stringIds.find(text);
+    if (found != stringIds.end())
+    {
+        id = found->second; // from an earlier run, read back by Open
+    }
+    else
+    {
+        id = static_cast<uint32_t>(strings.size());
+        if (!*ok || !Reserve(recordBytes(sizeof(id) + text.size())))
+        {
+            *ok = false;
+            return 0;
+        }
+        WriteRecord(KIND_STRING, &id, sizeof(id), text.data(), text.size());
+        strings.push_back(text);
+        stringIds.emplace(text, id);
+    }
+
+    if (tag.Id() >= tagStringIds.size())
+        tagStringIds.resize(tag.Id() + 1, NO_STRING);
+    tagStringIds[tag.Id()] = id;
+    return id;
+}
+
+void HistoryLog::WriteRecord(uint16_t kind, const void *payload, size_t length, const void *tail, size_t tailLength)
+{
+    unsigned char *record = base + end;
+    memcpy(record + RECORD_HEADER_BYTES, payload, length);
+    if (tailLength)
+        memcpy(record + RECORD_HEADER_BYTES + length, tail, tailLength);
+
+    RecordHeader header;
+    header.kind = kind;
+    header.length = static_cast<uint16_t>(length + tailLength);
+    header.checksum = checksum(kind, record + RECORD_HEADER_BYTES, header.length);
+    memcpy(record, &header, sizeof(header));
+    end += recordBytes(header.length);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "tag.h"
+
+// Listening history as an append-only binary file, written through a memory mapping.
+//
+// After a 16 byte file header come 8 byte aligned records, each an 8 byte header (kind, payload
+// length, checksum of both plus the payload) and its payload. A play is a fixed 32 bytes that
+// refers to artist, album and title by id; the first time a string is seen it's interned with a
+// string record ahead of the play, so every id a play uses is already on disk before it. Opening
+// keeps everything up to the first record that's torn or fails its checksum and drops the rest,
+// so a crash mid-append loses at most that append.
+//
+// Appends are a memcpy into the mapping. The mapping is msync'd once FLUSH_INTERVAL has passed
+// since the last sync, on Flush and on Close; until then the OS writes pages back on its own
+// schedule, which only matters if the machine itself goes down.
+
+struct Play
+{
+    int64_t startedAtMs = 0; // unix time
+    int32_t listenedMs = 0;  // time spent actually playing, not the track's length
+    int32_t durationMs = -1; // track length, -1 when unknown
+    Tag artist;
+    Tag album;
+    Tag title;
+};
+
+// a play as stored, strings as ids into HistoryLog::Strings()
+struct PlayRecord
+{
+    int64_t startedAtMs;
+    int32_t listenedMs;
+    int32_t durationMs;
+    uint32_t artistId;
+    uint32_t albumId;
+    uint32_t titleId;
+    uint32_t reserved;
+};
+static_assert(sizeof(PlayRecord) == 32, "the on-disk play layout");
+
+class HistoryLog
+{
+public:
+    static constexpr std::chrono::seconds FLUSH_INTERVAL{30};
+    static constexpr size_t MAX_STRING_BYTES = 1024; // longer tags are cut, on a utf-8 boundary
+
+    HistoryLog() = default;
+    ~HistoryLog();
+
+    HistoryLog(const HistoryLog &) = delete;
+    HistoryLog &operator=(const HistoryLog &) = delete;
+
+    // creates the file (and its directory), or recovers an existing one; false if neither works.
+    // readOnly maps an existing file as it is, for reading it while another process appends
+    bool Open(const std::string &path, bool readOnly = false);
+    // syncs and trims the file to what's been written
+    void Close();
+    bool IsOpen() const { return base != nullptr; }
+
+    bool Append(const Play &play);
+    bool Flush();
+
+    size_t PlayCount() const { return playCount; }
+    const std::vector<std::string> &Strings() const { return strings; }
+
+    // every play stored from cursor on, oldest first (0 is the start). returns the cursor to pass
+    // next time to get only what was appended since
+    size_t ForEachPlay(const std::function<void(const PlayRecord &)> &fn, size_t cursor = 0) const;
+
+    // <local app data>/DiscordMusicBee/history.dmbh
+    static std::string DefaultPath();
+    // "--history <file>" or DMB_HISTORY, else DefaultPath; "off" turns it off (empty result)
+    static std::string PathFromArgs(int argc, char *argv[]);
+
+private:
+    unsigned char *base = nullptr;
+    size_t capacity = 0; // mapped bytes
+    size_t end = 0;      // first free byte
+    size_t syncedTo = 0;
+    std::chrono::steady_clock::time_point lastSync;
+    bool readOnly = false;
+    size_t playCount = 0;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> stringIds;
+    std::vector<uint32_t> tagStringIds; // string id by Tag id, so a tag seen before isn't hashed again
+
+#ifdef _WIN32
+    void *file = nullptr;    // HANDLE
+    void *mapping = nullptr; // HANDLE
+#else
+    int file = -1;
+#endif
+
+    bool Map(size_t size);
+    void Unmap();
+    bool Reserve(size_t bytes);
+    bool Recover();
+    uint32_t Intern(const Tag &tag, bool *ok);
+    void WriteRecord(uint16_t kind, const void *payload, size_t length, const void *tail = nullptr, size_t tailLength = 0);
+};
@@ -0,0 +1,297 @@
+#include "history_stats.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+    const int LANES = 4;
+
+    uint64_t pairKey(uint32_t artistId, uint32_t nameId)
+    {
+        return (static_cast<uint64_t>(artistId) << 32) | nameId;
+    }
+
+    uint32_t denseId(std::unordered_map<uint64_t, uint32_t> &ids, uint64_t key, size_t next, bool *added)
+    {
+        const auto inserted = ids.try_emplace(key, static_cast<uint32_t>(next)); // no node made when it is there
+        *added = inserted.second;
+        return inserted.first->second;
+    }
+
+    // Plays and listened time per id over rows [first, last). Each id has LANES counters and row
+    // i goes to lane i % LANES, so an album played straight through (the same id row after row)
+    // doesn't make every increment wait on the one before it; the lanes are summed at the end.
+    void tallyRows(const uint32_t *ids, const int32_t *listened, size_t first, size_t last,
+                   std::vector<uint32_t> &plays, std::vector<int64_t> &time)
+    {
+        size_t i = first;
+        for (; i + LANES <= last; i += LANES)
+        {
+            for (int lane = 0; lane < LANES; ++lane)
+            {
+                const size_t slot = static_cast<size_t>(ids[i + lane]) * LANES + lane;
+                plays[slot] += 1;
+                time[slot] += listened[i + lane];
+            }
+        }
+        for (; i < last; ++i)
+        {
+            const size_t slot = static_cast<size_t>(ids[i]) * LANES;
+            plays[slot] += 1;
+            time[slot] += listened[i];
+        }
+    }
+
+    void writeEntries(rapidjson::Writer<rapidjson::StringBuffer> &writer, const char *key,
+                      const std::vector<HistoryStats::Entry> &entries)
+    {
+        writer.Key(key);
+        writer.StartArray();
+        for (const HistoryStats::Entry &entry : entries)
+        {
+            writer.StartObject();
+            writer.Key("name");
+            writer.String(entry.name.c_str(), static_cast<rapidjson::SizeType>(entry.name.size()));
+            if (!entry.artist.empty())
+            {
+                writer.Key("artist");
+                writer.String(entry.artist.c_str(), static_cast<rapidjson::SizeType>(entry.artist.size()));
+            }
+            writer.Key("plays");
+            writer.Uint(entry.plays);
+            writer.Key("listened_ms");
+            writer.Int64(entry.listenedMs);
+            writer.EndObject();
+        }
+        writer.EndArray();
+    }
+}
+
+void HistoryStats::Update(const HistoryLog &log)
+{
+    logCursor = log.ForEachPlay([this, &log](const PlayRecord &play)
+                                { Add(play, log.Strings()); },
+                                logCursor);
+}
+
+void HistoryStats::Add(const PlayRecord &play, const std::vector<std::string> &logStrings)
+{
+    for (size_t id = strings.size(); id < logStrings.size(); ++id)
+        strings.push_back(logStrings[id]);
+
+    if (!startedAtMs.empty() && play.startedAtMs < startedAtMs.back())
+        ordered = false; // the clock went back; queries scan everything from now on
+
+    bool added = false;
+    const uint32_t artist = denseId(artistIds, play.artistId, artists.size(), &added);
+    if (added)
+        artists.push_back(play.artistId);
+
+    const uint32_t album = denseId(albumIds, pairKey(play.artistId, play.albumId), albums.size(), &added);
+    if (added)
+        albums.push_back({play.albumId, play.artistId});
+
+    const uint32_t track = denseId(trackIds, pairKey(play.artistId, play.titleId), tracks.size(), &added);
+    if (added)
+        tracks.push_back({play.titleId, play.artistId});
+
+    startedAtMs.push_back(play.startedAtMs);
+    listenedMs.push_back(play.listenedMs);
+    artistColumn.push_back(artist);
+    albumColumn.push_back(album);
+    trackColumn.push_back(track);
+}
+
+void HistoryStats::Clear()
+{
+    *this = HistoryStats();
+}
+
+size_t HistoryStats::Plays(int64_t fromMs, int64_t toMs) const
+{
+    size_t first, last;
+    Range(fromMs, toMs, &first, &last);
+    if (ordered)
+        return last - first;
+
+    size_t plays = 0;
+    for (size_t i = first; i < last; ++i)
+        plays += startedAtMs[i] >= fromMs && startedAtMs[i] < toMs;
+    return plays;
+}
+
+int64_t HistoryStats::ListenedMs(int64_t fromMs, int64_t toMs) const
+{
+    size_t first, last;
+    Range(fromMs, toMs, &first, &last);
+
+    // widened to 64 bits as it's summed, which the compiler turns into vector adds
+    int64_t total = 0;
+    if (ordered)
+    {
+        for (size_t i = first; i < last; ++i)
+            total += listenedMs[i];
+    }
+    else
+    {
+        for (size_t i = first; i < last; ++i)
+            total += (startedAtMs[i] >= fromMs && startedAtMs[i] < toMs) ? listenedMs[i] : 0;
+    }
+    return total;
+}
+
+std::vector<HistoryStats::Entry> HistoryStats::TopArtists(int64_t fromMs, int64_t toMs, size_t limit) const
+{
+    std::vector<Entry> entries;
+    for (const Tally &tally : Top(artistColumn, artists.size(), fromMs, toMs, limit))
+        entries.push_back({strings[artists[tally.id]], std::string(), tally.plays, tally.listenedMs});
+    return entries;
+}
+
+std::vector<HistoryStats::Entry> HistoryStats::TopAlbums(int64_t fromMs, int64_t toMs, size_t limit) const
+{
+    std::vector<Entry> entries;
+    for (const Tally &tally : Top(albumColumn, albums.size(), fromMs, toMs, limit))
+    {
+        const Group &album = albums[tally.id];
+        entries.push_back({strings[album.nameId], strings[album.artistId], tally.plays, tally.listenedMs});
+    }
+    return entries;
+}
+
+std::vector<HistoryStats::Entry> HistoryStats::TopTracks(int64_t fromMs, int64_t toMs, size_t limit) const
+{
+    std::vector<Entry> entries;
+    for (const Tally &tally : Top(trackColumn, tracks.size(), fromMs, toMs, limit))
+    {
+        const Group &track = tracks[tally.id];
+        entries.push_back({strings[track.nameId], strings[track.artistId], tally.plays, tally.listenedMs});
+    }
+    return entries;
+}
+
+void HistoryStats::Range(int64_t fromMs, int64_t toMs, size_t *first, size_t *last) const
+{
+    if (!ordered)
+    {
+        *first = 0;
+        *last = startedAtMs.size();
+        return;
+    }
+    *first = std::lower_bound(startedAtMs.begin(), startedAtMs.end(), fromMs) - startedAtMs.begin();
+    *last = std::lower_bound(startedAtMs.begin() + *first, startedAtMs.end(), toMs) - startedAtMs.begin();
+}
+
+std::vector<HistoryStats::Tally> HistoryStats::Top(const std::vector<uint32_t> &column, size_t groups, int64_t fromMs,
+                                                   int64_t toMs, size_t limit) const
+{
+    size_t first, last;
+    Range(fromMs, toMs, &first, &last);
+
+    std::vector<Tally> tallies;
+    if (ordered && (last - first) * LANES < groups)
+    {
+        // a short range (a week) against many groups (every track ever played): sorting its own
+        // rows beats clearing and sweeping a counter for every group
+        std::vector<std::pair<uint32_t, int32_t>> rows;
+        rows.reserve(last - first);
+        for (size_t i = first; i < last; ++i)
+            rows.emplace_back(column[i], listenedMs[i]);
+        std::sort(rows.begin(), rows.end());
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            if (tallies.empty() || tallies.back().id != rows[i].first)
+                tallies.push_back({rows[i].first, 0, 0});
+            tallies.back().plays += 1;
+            tallies.back().listenedMs += rows[i].second;
+        }
+    }
+    else
+    {
+        std::vector<uint32_t> plays(groups * LANES);
+        std::vector<int64_t> time(groups * LANES);
+        if (ordered)
+        {
+            tallyRows(column.data(), listenedMs.data(), first, last, plays, time);
+        }
+        else
+        {
+            for (size_t i = first; i < last; ++i)
+            {
+                if (startedAtMs[i] < fromMs || startedAtMs[i] >= toMs)
+                    continue;
+                plays[static_cast<size_t>(column[i]) * LANES] += 1;
+                time[static_cast<size_t>(column[i]) * LANES] += listenedMs[i];
+            }
+        }
+
+        for (size_t id = 0; id < groups; ++id)
+        {
+            Tally tally = {static_cast<uint32_t>(id), 0, 0};
+            for (int lane = 0; lane < LANES; ++lane)
+            {
+                tally.plays += plays[id * LANES + lane];
+                tally.listenedMs += time[id * LANES + lane];
+            }
+            if (tally.plays)
+                tallies.push_back(tally);
+        }
+    }
+
+    // most plays first, longer listening breaking ties
+    const auto before = [](const Tally &a, const Tally &b)
+    { return a.plays != b.plays ? a.plays > b.plays : a.listenedMs > b.listenedMs; };
+    if (tallies.size() > limit)
+    {
+        std::partial_sort(tallies.begin(), tallies.begin() + limit, tallies.end(), before);
+        tallies.resize(limit);
+    }
+    else
+    {
+        std::sort(tallies.begin(), tallies.end(), before);
+    }
+    return tallies;
+}
+
+std::string describeStatsJson(const HistoryStats &stats, int64_t fromMs, int64_t toMs, size_t limit)
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("from");
+    writer.Int64(fromMs);
+    writer.Key("to");
+    writer.Int64(toMs);
+    writer.Key("plays");
+    writer.Uint64(stats.Plays(fromMs, toMs));
+    writer.Key("listened_ms");
+    writer.Int64(stats.ListenedMs(fromMs, toMs));
+    writeEntries(writer, "top_artists", stats.TopArtists(fromMs, toMs, limit));
+    writeEntries(writer, "top_albums", stats.TopAlbums(fromMs, toMs, limit));
+    writeEntries(writer, "top_tracks", stats.TopTracks(fromMs, toMs, limit));
+    writer.EndObject();
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+int printHistoryStats(const std::string &path)
+{
+    // read only, so it works while the bridge itself is appending to the same file
+    HistoryLog log;
+    if (path.empty() || !log.Open(path, true))
+    {
+        fprintf(stderr, "stats: couldn't read the history at %s\n", path.c_str());
+        return 1;
+    }
+
+    HistoryStats stats;
+    stats.Update(log);
+    const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::system_clock::now().time_since_epoch())
+                            .count();
+    const int64_t week = 7LL * 24 * 60 * 60 * 1000;
+    printf("%s\n", describeStatsJson(stats, now - week, now, 10).c_str());
+    return 0;
+}
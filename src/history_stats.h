@@ -0,0 +1,81 @@
+#pragma once
+
+#include "history_log.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The listening history laid out by column for the stats the window shows: start time and
+// listened time arrays, plus artist, album and track columns holding dense dictionary ids. A
+// query binary searches its time range (plays are logged in order) and makes one counting pass
+// over the id column into a flat array, so a week out of a million plays takes microseconds and
+// all of them a few milliseconds. Update only reads what the log gained since the last call.
+class HistoryStats
+{
+public:
+    struct Entry
+    {
+        std::string name;   // artist, album or track title
+        std::string artist; // empty for artists
+        uint32_t plays = 0;
+        int64_t listenedMs = 0;
+    };
+
+    // ingest whatever was appended to the log since the last call
+    void Update(const HistoryLog &log);
+    // one play; strings is the log's string table, at least up to the ids the play uses
+    void Add(const PlayRecord &play, const std::vector<std::string> &strings);
+    void Clear();
+
+    size_t PlayCount() const { return startedAtMs.size(); }
+
+    // over plays started in [fromMs, toMs)
+    size_t Plays(int64_t fromMs, int64_t toMs) const;
+    int64_t ListenedMs(int64_t fromMs, int64_t toMs) const;
+    std::vector<Entry> TopArtists(int64_t fromMs, int64_t toMs, size_t limit) const;
+    std::vector<Entry> TopAlbums(int64_t fromMs, int64_t toMs, size_t limit) const;
+    std::vector<Entry> TopTracks(int64_t fromMs, int64_t toMs, size_t limit) const;
+
+private:
+    // an album or track: its name and artist as string ids
+    struct Group
+    {
+        uint32_t nameId;
+        uint32_t artistId;
+    };
+
+    std::vector<int64_t> startedAtMs;
+    std::vector<int32_t> listenedMs;
+    std::vector<uint32_t> artistColumn;
+    std::vector<uint32_t> albumColumn;
+    std::vector<uint32_t> trackColumn;
+    bool ordered = true; // start times never go backwards, so ranges can be binary searched
+
+    std::vector<std::string> strings; // the log's, copied as they come in
+    std::vector<uint32_t> artists;    // dense id -> string id
+    std::vector<Group> albums;
+    std::vector<Group> tracks;
+    std::unordered_map<uint64_t, uint32_t> artistIds; // string id -> dense id
+    std::unordered_map<uint64_t, uint32_t> albumIds;  // artist << 32 | album string id
+    std::unordered_map<uint64_t, uint32_t> trackIds;  // artist << 32 | title string id
+    size_t logCursor = 0;
+
+    struct Tally
+    {
+        uint32_t id;
+        uint32_t plays;
+        int64_t listenedMs;
+    };
+
+    // the rows a query over [fromMs, toMs) has to look at; all of them if the log isn't ordered
+    void Range(int64_t fromMs, int64_t toMs, size_t *first, size_t *last) const;
+    std::vector<Tally> Top(const std::vector<uint32_t> &column, size_t groups, int64_t fromMs, int64_t toMs, size_t limit) const;
+};
+
+// {"from":..,"to":..,"listened_ms":..,"plays":..,"top_artists":[..],"top_albums":[..],"top_tracks":[..]}
+std::string describeStatsJson(const HistoryStats &stats, int64_t fromMs, int64_t toMs, size_t limit);
+
+// for --stats: the last 7 days of the history at path as JSON on stdout, exit code for main
+int printHistoryStats(const std::string &path);
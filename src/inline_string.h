@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+// Up to N bytes of UTF-8 kept inside the object, for text a poll builds every tick (a tag as it's
+// decoded, the presence's fields): filling, copying and comparing one never touches the heap.
+// Text past N is cut at a code point, so what's kept is still valid UTF-8. Always nul terminated,
+// for c_str.
+template <size_t N>
+class InlineString
+{
+public:
+    static constexpr size_t CAPACITY = N;
+
+    InlineString() { text[0] = '\0'; }
+    explicit InlineString(std::string_view value) { assign(value); }
+
+    // only the bytes in use are copied, not all N
+    InlineString(const InlineString &other) { assign(other.view()); }
+    InlineString &operator=(const InlineString &other)
+    {
+        if (this != &other)
+            assign(other.view());
+        return *this;
+    }
+    InlineString &operator=(std::string_view value)
+    {
+        assign(value);
+        return *this;
+    }
+
+    void assign(std::string_view value)
+    {
+        length = 0;
+        append(value);
+    }
+
+    void append(std::string_view value)
+    {
+        size_t count = value.size() < N - length ? value.size() : N - length;
+        if (count < value.size())
+        {
+            // back up to the start of the code point that didn't fit
+            while (count > 0 && (static_cast<unsigned char>(value[count]) & 0xC0) == 0x80)
+                --count;
+        }
+        memcpy(text + length, value.data(), count);
+        length += count;
+        text[length] = '\0';
+    }
+
+    void clear() { resize(0); }
+
+    // for filling in place: write up to N bytes at buffer(), then resize to what was written
+    char *buffer() { return text; }
+    void resize(size_t size)
+    {
+        length = size < N ? size : N;
+        text[length] = '\0';
+    }
+
+    const char *data() const { return text; }
+    const char *c_str() const { return text; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    std::string_view view() const { return std::string_view(text, length); }
+    operator std::string_view() const { return view(); }
+
+    friend bool operator==(const InlineString &a, const InlineString &b) { return a.view() == b.view(); }
+    friend bool operator!=(const InlineString &a, const InlineString &b) { return a.view() != b.view(); }
+    friend bool operator==(const InlineString &a, std::string_view b) { return a.view() == b; }
+    friend bool operator!=(const InlineString &a, std::string_view b) { return a.view() != b; }
+
+private:
+    size_t length = 0;
+    char text[N + 1];
+};
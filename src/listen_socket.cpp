@@ -0,0 +1,130 @@
+#include "listen_socket.h"
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char *DEFAULT_HOST = "127.0.0.1";
+    const int BACKLOG = 64; // overlays reconnect all at once when OBS switches scenes
+}
+
+bool startSockets()
+{
+#ifdef _WIN32
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+#else
+    return true;
+#endif
+}
+
+void stopSockets()
+{
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+Socket listenOn(const std::string &address, std::string *unixPath)
+{
+#ifndef _WIN32
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        sockaddr_un local;
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        const std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(local.sun_path))
+            return NO_SOCKET;
+        memcpy(local.sun_path, path.c_str(), path.size());
+
+        Socket socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket == NO_SOCKET)
+            return NO_SOCKET;
+        unlink(path.c_str()); // left behind by a run that didn't exit cleanly
+        if (bind(socket, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0 || listen(socket, BACKLOG) != 0)
+        {
+            closeSocket(socket);
+            return NO_SOCKET;
+        }
+        *unixPath = path;
+        return socket;
+    }
+#endif
+
+    // "9464" or "host:9464"; the last colon splits, so "[::1]:9464" works too
+    std::string host = DEFAULT_HOST;
+    std::string port = address;
+    const size_t colon = address.rfind(':');
+    if (colon != std::string::npos)
+    {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+    }
+    if (port.empty() || port.find_first_not_of("0123456789") != std::string::npos)
+        return NO_SOCKET;
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0)
+        return NO_SOCKET;
+
+    Socket socket = NO_SOCKET;
+    for (addrinfo *candidate = found; candidate && socket == NO_SOCKET; candidate = candidate->ai_next)
+    {
+        socket = ::socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (socket == NO_SOCKET)
+            continue;
+        const int reuse = 1;
+        setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&reuse), sizeof(reuse));
+        if (bind(socket, candidate->ai_addr, static_cast<int>(candidate->ai_addrlen)) != 0 || listen(socket, BACKLOG) != 0)
+        {
+            closeSocket(socket);
+            socket = NO_SOCKET;
+        }
+    }
+    freeaddrinfo(found);
+    return socket;
+}
+
+void closeSocket(Socket socket)
+{
+#ifdef _WIN32
+    closesocket(socket);
+#else
+    close(socket);
+#endif
+}
+
+void setNonBlocking(Socket socket, bool nonBlocking)
+{
+#ifdef _WIN32
+    u_long on = nonBlocking ? 1 : 0;
+    ioctlsocket(socket, FIONBIO, &on);
+#else
+    const int flags = fcntl(socket, F_GETFL, 0);
+    fcntl(socket, F_SETFL, nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+#endif
+}
+
+bool wouldBlock()
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+// The listening side shared by the metrics and overlay endpoints. Both take the same address
+// forms: a port ("9464", bound to 127.0.0.1), "host:port" ("[::1]:9464" for IPv6), or
+// "unix:/path/to.sock" outside Windows.
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+const Socket NO_SOCKET = INVALID_SOCKET;
+#else
+typedef int Socket;
+const Socket NO_SOCKET = -1;
+#endif
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL; // a client hanging up early isn't worth a SIGPIPE
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+// WSAStartup/WSACleanup on Windows, nothing elsewhere; each start needs its stop
+bool startSockets();
+void stopSockets();
+
+// NO_SOCKET if the address doesn't parse or can't be bound. A unix socket's path is stored in
+// unixPath, for the caller to unlink once it's done
+Socket listenOn(const std::string &address, std::string *unixPath);
+
+void closeSocket(Socket socket);
+void setNonBlocking(Socket socket, bool nonBlocking);
+// true when the last failed send/recv/accept only means "not now" on a non-blocking socket
+bool wouldBlock();
@@ -0,0 +1,354 @@
+#include "metrics.h"
+#include "discord_rpc.h"
+#include "listen_socket.h"
+#include "startup_trace.h"
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const int CLIENT_TIMEOUT_MS = 1000; // a scraper that stalls mid-request is dropped
+    const size_t MAX_REQUEST_BYTES = 4096;
+
+    // upper bounds in microseconds; a SendMessage to MusicBee is usually tens of them
+    const long long IPC_BUCKETS_US[] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000};
+    const int IPC_BUCKET_COUNT = sizeof(IPC_BUCKETS_US) / sizeof(IPC_BUCKETS_US[0]);
+
+    const char *IPC_COMMAND_NAMES[] = {"Connect", "GetPlayState", "GetPosition", "GetDuration",
+                                       "GetFileUrl", "GetFileTag", "GetArtwork"};
+    const char *POLL_STATE_NAMES[] = {"playing", "paused", "stopped", "absent"};
+    const char *PRESENCE_OUTCOME_NAMES[] = {"sent", "repeated", "over_limit"};
+    const char *ARTWORK_LOOKUP_NAMES[] = {"memory", "disk", "miss"};
+    const char *SINK_NAMES[] = {"discord", "history", "overlay", "text_file"};
+
+    struct IpcHistogram
+    {
+        std::atomic<uint64_t> buckets[IPC_BUCKET_COUNT + 1]; // the last one is +Inf
+        std::atomic<uint64_t> sumNs;
+    };
+
+    std::atomic<uint64_t> pollTicks[static_cast<int>(PollScheduler::State::Count)];
+    std::atomic<uint64_t> presenceUpdates[static_cast<int>(PresenceOutcome::Count)];
+    std::atomic<uint64_t> artworkLookups[static_cast<int>(ArtworkLookup::Count)];
+    std::atomic<uint64_t> sinkDrops[static_cast<int>(SinkKind::Count)];
+    IpcHistogram ipcLatency[static_cast<int>(IpcCommand::Count)];
+
+    std::atomic_bool enabled{false};
+    std::thread server;
+    Socket listener = NO_SOCKET;
+    std::string unixPath; // of a unix socket listener, removed again by stopMetrics
+#ifndef _WIN32
+    int wakePipe[2] = {-1, -1}; // written to by stopMetrics
+#endif
+
+    long long nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void increment(std::atomic<uint64_t> &counter, uint64_t by = 1)
+    {
+        counter.fetch_add(by, std::memory_order_relaxed);
+    }
+
+    uint64_t valueOf(const std::atomic<uint64_t> &counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    void appendf(std::string &out, const char *format, ...)
+    {
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        const int length = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        if (length > 0)
+            out.append(line, static_cast<size_t>(length) < sizeof(line) ? length : sizeof(line) - 1);
+    }
+
+    void appendHeader(std::string &out, const char *name, const char *type, const char *help)
+    {
+        appendf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    }
+
+    void appendLabelled(std::string &out, const char *name, const char *label, const char *const *values,
+                        const std::atomic<uint64_t> *counters, int count)
+    {
+        for (int i = 0; i < count; ++i)
+            appendf(out, "%s{%s=\"%s\"} %llu\n", name, label, values[i], static_cast<unsigned long long>(valueOf(counters[i])));
+    }
+
+    void setTimeouts(Socket socket)
+    {
+#ifdef _WIN32
+        const DWORD timeout = CLIENT_TIMEOUT_MS;
+#else
+        timeval timeout;
+        timeout.tv_sec = CLIENT_TIMEOUT_MS / 1000;
+        timeout.tv_usec = (CLIENT_TIMEOUT_MS % 1000) * 1000;
+#endif
+        setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&timeout), sizeof(timeout));
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char *>(&timeout), sizeof(timeout));
+    }
+
+    void sendAll(Socket socket, const std::string &data)
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            const int result = send(socket, data.data() + sent, static_cast<int>(data.size() - sent), SEND_FLAGS);
+            if (result <= 0)
+                return;
+            sent += static_cast<size_t>(result);
+        }
+    }
+
+    // one request per connection, HTTP/1.0 style: read the request line, answer, close
+    void serveClient(Socket client)
+    {
+        // windows hands out accepted sockets non-blocking like the listener; the timeouts bound it
+        setNonBlocking(client, false);
+        setTimeouts(client);
+
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST_BYTES)
+        {
+            const int received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+                break;
+            request.append(buffer, received);
+        }
+
+        const bool wantsMetrics = request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0;
+        const std::string body = wantsMetrics ? renderMetrics() : "not found\n";
+
+        std::string response;
+        appendf(response, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %llu\r\nConnection: close\r\n\r\n",
+                wantsMetrics ? "200 OK" : "404 Not Found",
+                wantsMetrics ? "text/plain; version=0.0.4; charset=utf-8" : "text/plain",
+                static_cast<unsigned long long>(body.size()));
+        response += body;
+        sendAll(client, response);
+        closeSocket(client);
+    }
+
+    void serve()
+    {
+        for (;;)
+        {
+#ifdef _WIN32
+            // stopMetrics closes the listener, which wakes this with an error
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(listener, &readable);
+            if (select(0, &readable, nullptr, nullptr, nullptr) == SOCKET_ERROR || !enabled)
+                return;
+#else
+            pollfd watched[2] = {{listener, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+            if (poll(watched, 2, -1) < 0)
+                continue; // EINTR
+            if (watched[1].revents || !enabled)
+                return;
+#endif
+            const Socket client = accept(listener, nullptr, nullptr);
+            if (client == NO_SOCKET)
+                continue; // the scraper gave up between poll and accept
+            serveClient(client);
+        }
+    }
+}
+
+bool startMetrics(const std::string &address)
+{
+    if (enabled || address.empty())
+        return false;
+
+    if (!startSockets())
+        return false;
+    listener = listenOn(address, &unixPath);
+    if (listener == NO_SOCKET)
+    {
+        stopSockets();
+        return false;
+    }
+    // accept never blocks, readiness comes from poll/select
+    setNonBlocking(listener, true);
+
+#ifdef _WIN32
+    enabled = true;
+    server = std::thread(serve);
+#else
+    if (pipe(wakePipe) != 0)
+    {
+        closeSocket(listener);
+        listener = NO_SOCKET;
+        return false;
+    }
+    enabled = true;
+
+    // the thread inherits this mask, so ctrl-c and friends keep going to whoever waits for them
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    server = std::thread(serve);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+#endif
+    return true;
+}
+
+bool startMetricsFromArgs(int argc, char *argv[])
+{
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], "--metrics") == 0)
+            return startMetrics(argv[i + 1]);
+    }
+
+    const char *address = std::getenv("DMB_METRICS");
+    return address ? startMetrics(address) : true;
+}
+
+void stopMetrics()
+{
+    if (!enabled)
+        return;
+    enabled = false;
+
+#ifdef _WIN32
+    closeSocket(listener);
+    server.join();
+    stopSockets();
+#else
+    const char wake = 0;
+    if (write(wakePipe[1], &wake, 1) < 0)
+        perror("metrics");
+    server.join();
+    closeSocket(listener);
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    if (!unixPath.empty())
+        unlink(unixPath.c_str());
+    unixPath.clear();
+#endif
+    listener = NO_SOCKET;
+}
+
+bool metricsEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void countPollTick(PollScheduler::State state)
+{
+    increment(pollTicks[static_cast<int>(state)]);
+}
+
+void countPresence(PresenceOutcome outcome)
+{
+    increment(presenceUpdates[static_cast<int>(outcome)]);
+}
+
+void countArtworkLookup(ArtworkLookup lookup)
+{
+    increment(artworkLookups[static_cast<int>(lookup)]);
+}
+
+void countSinkDrop(SinkKind sink)
+{
+    increment(sinkDrops[static_cast<int>(sink)]);
+}
+
+std::string renderMetrics()
+{
+    std::string out;
+    out.reserve(8 * 1024);
+
+    appendHeader(out, "dmb_poll_ticks_total", "counter", "MusicBee polls, by the player state they found.");
+    appendLabelled(out, "dmb_poll_ticks_total", "state", POLL_STATE_NAMES, pollTicks, static_cast<int>(PollScheduler::State::Count));
+
+    appendHeader(out, "dmb_ipc_duration_seconds", "histogram", "MusicBee IPC round trips, by command.");
+    for (int command = 0; command < static_cast<int>(IpcCommand::Count); ++command)
+    {
+        const IpcHistogram &histogram = ipcLatency[command];
+        uint64_t cumulative = 0;
+        for (int bucket = 0; bucket <= IPC_BUCKET_COUNT; ++bucket)
+        {
+            cumulative += valueOf(histogram.buckets[bucket]);
+            if (bucket < IPC_BUCKET_COUNT)
+                appendf(out, "dmb_ipc_duration_seconds_bucket{command=\"%s\",le=\"%g\"} %llu\n", IPC_COMMAND_NAMES[command],
+                        IPC_BUCKETS_US[bucket] / 1e6, static_cast<unsigned long long>(cumulative));
+            else
+                appendf(out, "dmb_ipc_duration_seconds_bucket{command=\"%s\",le=\"+Inf\"} %llu\n", IPC_COMMAND_NAMES[command],
+                        static_cast<unsigned long long>(cumulative));
+        }
+        appendf(out, "dmb_ipc_duration_seconds_sum{command=\"%s\"} %.9f\n", IPC_COMMAND_NAMES[command], valueOf(histogram.sumNs) / 1e9);
+        appendf(out, "dmb_ipc_duration_seconds_count{command=\"%s\"} %llu\n", IPC_COMMAND_NAMES[command],
+                static_cast<unsigned long long>(cumulative));
+    }
+
+    appendHeader(out, "dmb_presence_updates_total", "counter", "Presences handed to Discord, by whether they changed, repeated the last one, or went past its 5 per 20 s limit. Every one is sent.");
+    appendLabelled(out, "dmb_presence_updates_total", "outcome", PRESENCE_OUTCOME_NAMES, presenceUpdates, static_cast<int>(PresenceOutcome::Count));
+
+    int connects = 0, disconnects = 0, lastConnectMs = -1, lastRttMs = -1, smoothedRttMs = -1;
+    Discord_GetConnectionStats(&connects, &disconnects, &lastConnectMs);
+    Discord_GetHeartbeatRtt(&lastRttMs, &smoothedRttMs);
+    appendHeader(out, "dmb_discord_connects_total", "counter", "Handshakes completed with the Discord client; every one after the first is a reconnect.");
+    appendf(out, "dmb_discord_connects_total %d\n", connects);
+    appendHeader(out, "dmb_discord_disconnects_total", "counter", "Established Discord connections that were lost.");
+    appendf(out, "dmb_discord_disconnects_total %d\n", disconnects);
+    appendHeader(out, "dmb_discord_events_dropped_total", "counter", "Discord events lost because callbacks fell over a thousand behind.");
+    appendf(out, "dmb_discord_events_dropped_total %d\n", Discord_GetDroppedEvents());
+    if (lastConnectMs >= 0)
+    {
+        appendHeader(out, "dmb_discord_connect_seconds", "gauge", "How long the last handshake took, pipe open to READY.");
+        appendf(out, "dmb_discord_connect_seconds %.3f\n", lastConnectMs / 1e3);
+    }
+    if (smoothedRttMs >= 0)
+    {
+        appendHeader(out, "dmb_discord_heartbeat_rtt_seconds", "gauge", "Smoothed round trip of the client side ping.");
+        appendf(out, "dmb_discord_heartbeat_rtt_seconds %.3f\n", smoothedRttMs / 1e3);
+    }
+
+    appendHeader(out, "dmb_artwork_lookups_total", "counter", "Cover art cache lookups, by the tier that answered.");
+    appendLabelled(out, "dmb_artwork_lookups_total", "result", ARTWORK_LOOKUP_NAMES, artworkLookups, static_cast<int>(ArtworkLookup::Count));
+
+    appendHeader(out, "dmb_sink_dropped_total", "counter", "Poll ticks a presence sink fell too far behind to get.");
+    appendLabelled(out, "dmb_sink_dropped_total", "sink", SINK_NAMES, sinkDrops, static_cast<int>(SinkKind::Count));
+
+    appendHeader(out, "process_resident_memory_bytes", "gauge", "Resident set size (working set on Windows).");
+    appendf(out, "process_resident_memory_bytes %llu\n", static_cast<unsigned long long>(workingSetBytes()));
+    return out;
+}
+
+IpcTimer::IpcTimer(IpcCommand command) : command(command), startNs(metricsEnabled() ? nowNs() : 0)
+{
+}
+
+IpcTimer::~IpcTimer()
+{
+    if (!startNs)
+        return;
+
+    const long long elapsedNs = nowNs() - startNs;
+    IpcHistogram &histogram = ipcLatency[static_cast<int>(command)];
+    int bucket = 0;
+    while (bucket < IPC_BUCKET_COUNT && elapsedNs > IPC_BUCKETS_US[bucket] * 1000)
+        ++bucket;
+    increment(histogram.buckets[bucket]);
+    increment(histogram.sumNs, static_cast<uint64_t>(elapsedNs));
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "poll_scheduler.h"
+#include <string>
+
+// Bridge health counters, served in Prometheus' text format when --metrics <address> or
+// DMB_METRICS=<address> is given. The address is a port ("9464", bound to 127.0.0.1), "host:port",
+// or "unix:/path/to.sock" outside Windows. Counting is a relaxed atomic add; IPC latency is only
+// timed while the endpoint is up, and the listener thread sleeps in poll()/select() until a
+// scraper connects.
+
+enum class IpcCommand
+{
+    Connect,
+    GetPlayState,
+    GetPosition,
+    GetDuration,
+    GetFileUrl,
+    GetFileTag,
+    GetArtwork,
+    Count
+};
+
+// what a presence handed to discord-rpc was; every one is sent, this only sorts them for counting
+enum class PresenceOutcome
+{
+    Sent,      // differs from the last one, within Discord's rate limit
+    Repeated,  // same as the last one sent
+    OverLimit, // past Discord's 5 updates per 20 s, Discord may hold it back
+    Count
+};
+
+enum class ArtworkLookup
+{
+    Memory,
+    Disk,
+    Miss,
+    Count
+};
+
+enum class SinkKind
+{
+    Discord,
+    History,
+    Overlay,
+    TextFile,
+    Count
+};
+
+// false if the address doesn't parse or can't be listened on
+bool startMetrics(const std::string &address);
+
+// startMetrics on DMB_METRICS or "--metrics <address>" (the flag wins); true if neither is given
+bool startMetricsFromArgs(int argc, char *argv[]);
+
+void stopMetrics();
+
+bool metricsEnabled();
+
+void countPollTick(PollScheduler::State state);
+void countPresence(PresenceOutcome outcome);
+void countArtworkLookup(ArtworkLookup lookup);
+void countSinkDrop(SinkKind sink);
+
+// the whole exposition, as a scrape would get it
+std::string renderMetrics();
+
+// times one MusicBee IPC round trip into its command's histogram
+class IpcTimer
+{
+public:
+    explicit IpcTimer(IpcCommand command);
+    ~IpcTimer();
+
+    IpcTimer(const IpcTimer &) = delete;
+    IpcTimer &operator=(const IpcTimer &) = delete;
+
+private:
+    IpcCommand command;
+    long long startNs; // 0 when metrics were off at construction
+};
@@ -6,6 +6,7 @@
 #include <QHBoxLayout>
 #include <QIcon>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QMainWindow>
 #include <QSystemTrayIcon>
 #include <QMenu>
@@ -15,100 +16,105 @@
 #include <QPixmap>
 #include <QFile>
 #include <QByteArray>
-#include <QPainter>
-#include <QPainterPath>
 #include <QBitmap>
+#include <QPalette>
+#include <QDebug>
+#include <QDateTime>
+#include <QStringList>
+#include <algorithm>
 #include <cstring>
 #include <string>
-#include <windows.h>
-#include <comdef.h>
 #include "discord_rpc.h"
 #include "musicbee_ipc.h"
-
-// app id from https://discord.com/developers/applications/
-std::string DISCORD_APP_ID = std::getenv("DISCORD_APP_ID");
-const char *DISCORD_DETAILS = "";
-const char *DISCORD_STATE = "";
-const char *DISCORD_LARGE_IMAGE_KEY = "something";       // https://discord.com/developers/applications/DISCORD_APP_ID/rich-presence/assets/something.png
-const char *DISCORD_LARGE_IMAGE_TEXT = "something-else"; // https://discord.com/developers/applications/DISCORD_APP_ID/rich-presence/assets/something-else.png
-
-struct MusicInfo
-{
-    std::string artist;
-    std::string title;
-    std::string album;
-    std::string artworkPath;
-    bool isPlaying = false;
-};
+#include "artwork_loader.h"
+#include "artwork_cache.h"
+#include "cover_palette.h"
+#include "history_stats.h"
+#include "metrics.h"
+#include "thumbnail_disk_cache.h"
+#include "now_playing_model.h"
+#include "overlay_server.h"
+#include "poll_scheduler.h"
+#include "presence_bridge.h"
+#include "presence_sinks.h"
+#include "startup_trace.h"
+#include "trace.h"
+
+const int ARTWORK_SIZE = 150;
+const int ARTWORK_RADIUS = 10;
+const float ACCENT_SATURATION = 0.6f; // of the cover's dominant colour, for the window background
+const float ACCENT_LIGHTNESS = 0.18f;
+const size_t ARTWORK_CACHE_BYTES = 8 * 1024 * 1024;     // ~90 finished covers at 150x150
+const qint64 THUMBNAIL_CACHE_BYTES = 32 * 1024 * 1024;  // on disk, as png
+const qint64 POLL_STATS_INTERVAL_MS = 60 * 60 * 1000;   // how often tick counts are logged
+const qint64 STATS_WINDOW_MS = 7LL * 24 * 60 * 60 * 1000; // what the stats line under the cover covers
 
 static MusicBeeIPC ipcClient;
 
-MusicInfo getMusicBeeInfo()
+class MainWindow : public QMainWindow
 {
-    MusicInfo info;
-
-    if (!ipcClient.IsConnected())
+public:
+    MainWindow(const std::string &historyPath, const std::string &nowPlayingFile) : QMainWindow(), discordTimer(new QTimer(this)), artworkLoader(new ArtworkLoader(this)),
+                   thumbnailCache(ThumbnailDiskCache::DefaultDirectory(), THUMBNAIL_CACHE_BYTES)
     {
-        if (!ipcClient.Connect())
-        {
-            return info;
-        }
+        // only what the first poll needs; widgets and the tray icon wait for showWindow
+        model.SetSongText("DiscordMusicBee 🎧\nwaiting for song...");
+        model.SetDefaultArtwork();
+        setupArtworkLoader();
+        if (!historyPath.empty() && !history.Open(historyPath))
+            qWarning("history: couldn't open %s", historyPath.c_str());
+        historySink = addBridgeSinks(pipeline, history, nowPlayingFile);
+        pollDiscord();
     }
 
-    // play state
-    MBPlayState playState = ipcClient.GetPlayState();
-    info.isPlaying = (playState == MBPlayState::Playing);
-
-    if (info.isPlaying)
+    // before Discord and the overlay server go away: whatever's queued is sent, the last play written
+    void stopSinks()
     {
-        // track metadata
-        info.title = ipcClient.GetFileTag(MBMetaDataType::TrackTitle);
-        info.artist = ipcClient.GetFileTag(MBMetaDataType::Artist);
-        info.album = ipcClient.GetFileTag(MBMetaDataType::Album);
-        info.artworkPath = ipcClient.GetArtwork();
+        pipeline.Stop();
     }
 
-    return info;
-}
-
-QPixmap createRoundedPixmap(const QPixmap &source, int radius)
-{
-    if (source.isNull())
-        return QPixmap();
-
-    QPixmap rounded(source.size());
-    rounded.fill(Qt::transparent);
-
-    QPainter painter(&rounded);
-    painter.setRenderHint(QPainter::Antialiasing);
-    painter.setRenderHint(QPainter::SmoothPixmapTransform);
-
-    QPainterPath path;
-    path.addRoundedRect(rounded.rect(), radius, radius);
-    painter.setClipPath(path);
-    painter.drawPixmap(0, 0, source);
-
-    return rounded;
-}
+    void showWindow()
+    {
+        if (!trayIcon)
+            setupTrayIcon();
+        if (!songLabel)
+            setupUI();
+
+        showNormal();
+        raise();
+        activateWindow();
+    }
 
-class MainWindow : public QMainWindow
-{
-public:
-    explicit MainWindow() : QMainWindow(), discordTimer(new QTimer(this))
+    // tray-only: start with just the tray icon, and throw the widgets away again whenever hidden
+    void showTrayOnly()
     {
-        setupUI();
-        setupTrayIcon();
-        pollDiscord();
+        releaseWhenHidden = true;
+        if (!trayIcon)
+            setupTrayIcon();
     }
 
 private:
     QTimer *discordTimer;
-    QLabel *songLabel;
-    QLabel *artworkLabel;
-    QSystemTrayIcon *trayIcon;
-    QMenu *trayMenu;
-    std::string currentDetails;
-    std::string currentState;
+    PollScheduler pollScheduler;
+    QElapsedTimer pollStatsTimer;
+    ArtworkLoader *artworkLoader;
+    ArtworkCache artworkCache{ARTWORK_CACHE_BYTES};
+    ThumbnailDiskCache thumbnailCache;
+    std::string artworkFileUrl;   // track whose artwork is showing (or being decoded); not fetched again while it plays
+    uint64_t requestedArtworkKey = 0; // for tracks without a file url, so an unchanged cover isn't decoded every tick
+    NowPlayingModel model;
+    QPixmap defaultArtwork; // app icon, decoded and scaled once
+    QLabel *songLabel = nullptr;
+    QLabel *artworkLabel = nullptr;
+    QLabel *statsLabel = nullptr;
+    QSystemTrayIcon *trayIcon = nullptr;
+    QMenu *trayMenu = nullptr;
+    HistoryLog history;
+    PresencePipeline pipeline; // after history, so the last play is written before it closes
+    HistorySink *historySink = nullptr; // owned by pipeline
+    HistoryStats stats; // only filled while there are widgets to show it
+    bool markedFirstPresence = false;
+    bool releaseWhenHidden = false;
 
     void setupUI()
     {
@@ -118,18 +124,32 @@ private:
         auto *centralWidget = new QWidget(this);
         setCentralWidget(centralWidget);
 
-        songLabel = new QLabel("DiscordMusicBee 🎧\nwaiting for song...", this);
+        songLabel = new QLabel(this);
         QFont font = songLabel->font();
         font.setPointSize(24);
         songLabel->setFont(font);
         songLabel->setAlignment(Qt::AlignCenter);
 
         artworkLabel = new QLabel(this);
-        artworkLabel->setFixedSize(150, 150);
+        artworkLabel->setFixedSize(ARTWORK_SIZE, ARTWORK_SIZE);
         artworkLabel->setAlignment(Qt::AlignCenter);
         artworkLabel->setScaledContents(false);
         artworkLabel->setStyleSheet("QLabel { border-radius: 10px; }");
-        setDefaultArtwork();
+
+        statsLabel = new QLabel(this);
+        QFont statsFont = statsLabel->font();
+        statsFont.setPointSize(9);
+        statsLabel->setFont(statsFont);
+        statsLabel->setAlignment(Qt::AlignCenter);
+        statsLabel->setWordWrap(true);
+
+        QPixmap icon(":/icon.png");
+        if (!icon.isNull())
+        {
+            const int pixels = artworkPixelSize();
+            defaultArtwork = icon.scaled(pixels, pixels, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            defaultArtwork.setDevicePixelRatio(devicePixelRatioF());
+        }
 
         auto *layout = new QVBoxLayout(centralWidget);
         layout->setContentsMargins(20, 20, 20, 20);
@@ -137,8 +157,109 @@ private:
         layout->addWidget(songLabel);
         layout->addWidget(artworkLabel);
         layout->setAlignment(artworkLabel, Qt::AlignCenter);
+        layout->addWidget(statsLabel);
+
+        if (!testAttribute(Qt::WA_Resized))
+            resize(600, 200);
 
-        resize(600, 200);
+        // the model may have moved on while there were no widgets
+        refreshStats();
+        model.MarkAllDirty();
+        render();
+    }
+
+    // push whatever changed in the model to the widgets, and nothing else
+    void render()
+    {
+        if (!songLabel)
+            return;
+
+        TraceSpan span("ui.render");
+        const unsigned dirty = model.TakeDirty();
+
+        if (dirty & NowPlayingModel::SongText)
+            songLabel->setText(model.GetSongText());
+
+        if (dirty & NowPlayingModel::Artwork)
+        {
+            if (model.GetArtworkKey() != NowPlayingModel::DEFAULT_ARTWORK)
+                artworkLabel->setPixmap(QPixmap::fromImage(model.GetArtwork()));
+            else if (!defaultArtwork.isNull())
+                artworkLabel->setPixmap(defaultArtwork);
+            else
+                artworkLabel->clear();
+
+            // read back from the image, the worker already picked it
+            applyAccent(paletteOf(model.GetArtwork()).Dominant());
+        }
+
+        if (dirty & NowPlayingModel::StatsText)
+            statsLabel->setText(model.GetStatsText());
+    }
+
+    // catch the stats up with whatever plays were logged since, and summarise the last week
+    void refreshStats()
+    {
+        if (!historySink)
+            return;
+
+        historySink->Read([this](const HistoryLog &log)
+                          { stats.Update(log); });
+        const int64_t now = QDateTime::currentMSecsSinceEpoch();
+        const int64_t from = now - STATS_WINDOW_MS;
+        const int64_t listenedMinutes = stats.ListenedMs(from, now) / 60000;
+        if (listenedMinutes == 0)
+        {
+            model.SetStatsText("nothing played this week");
+            return;
+        }
+
+        QStringList parts;
+        parts << QString("this week: %1h %2m").arg(listenedMinutes / 60).arg(listenedMinutes % 60);
+        const std::vector<HistoryStats::Entry> artists = stats.TopArtists(from, now, 1);
+        if (!artists.empty() && !artists[0].name.empty())
+            parts << QString::fromStdString(artists[0].name);
+        const std::vector<HistoryStats::Entry> albums = stats.TopAlbums(from, now, 1);
+        if (!albums.empty() && !albums[0].name.empty())
+            parts << QString::fromStdString(albums[0].name);
+        const std::vector<HistoryStats::Entry> tracks = stats.TopTracks(from, now, 1);
+        if (!tracks.empty())
+            parts << QString("%1 (%2 plays)").arg(QString::fromStdString(tracks[0].name)).arg(tracks[0].plays);
+        model.SetStatsText(parts.join(" · "));
+    }
+
+    // a dark shade of the cover's dominant colour behind the window; invalid puts the default back
+    void applyAccent(const QColor &accent)
+    {
+        QWidget *central = centralWidget();
+        if (!accent.isValid())
+        {
+            central->setAutoFillBackground(false);
+            central->setPalette(QPalette());
+            return;
+        }
+
+        QPalette palette = central->palette();
+        const float hue = std::max(accent.hslHueF(), 0.0f); // -1 for greys
+        palette.setColor(QPalette::Window, QColor::fromHslF(hue, accent.hslSaturationF() * ACCENT_SATURATION, ACCENT_LIGHTNESS));
+        palette.setColor(QPalette::WindowText, Qt::white);
+        central->setPalette(palette);
+        central->setAutoFillBackground(true);
+    }
+
+    void setupArtworkLoader()
+    {
+        connect(artworkLoader, &ArtworkLoader::artworkReady, this, [this](quint64 key, const QImage &image)
+                {
+            artworkCache.Insert(key, image);
+            if (!artworkFileUrl.empty())
+                thumbnailCache.Store(key, thumbnailUrl(artworkFileUrl), image);
+            model.SetArtwork(key, image);
+            render(); });
+        connect(artworkLoader, &ArtworkLoader::artworkFailed, this, [this]()
+                {
+            model.SetDefaultArtwork();
+            render(); });
     }
 
     void setupTrayIcon()
@@ -146,8 +267,26 @@ private:
         trayIcon = new QSystemTrayIcon(this);
         trayIcon->setIcon(QIcon(":/icon.ico"));
         trayIcon->setToolTip("DiscordMusicBee - MusicBee Discord Integration");
+
+        // styled and filled the first time it's opened
         trayMenu = new QMenu(this);
+        connect(trayMenu, &QMenu::aboutToShow, this, [this]()
+                {
+            if (trayMenu->isEmpty())
+                populateTrayMenu(); });
+        trayIcon->setContextMenu(trayMenu);
+
+        connect(trayIcon, &QSystemTrayIcon::activated, [this](QSystemTrayIcon::ActivationReason reason)
+                {
+            if (reason == QSystemTrayIcon::DoubleClick) {
+                showWindow();
+            } });
 
+        trayIcon->show();
+    }
+
+    void populateTrayMenu()
+    {
         trayMenu->setStyleSheet(
             "QMenu { padding: 6px; }"
             "QMenu::item { padding: 6px 20px 6px 10px; }"
@@ -155,10 +294,7 @@ private:
 
         QAction *showAction = new QAction("DiscordMusicBee", this);
         connect(showAction, &QAction::triggered, [this]()
-                {
-            showNormal();
-            raise();
-            activateWindow(); });
+                { showWindow(); });
 
         QAction *quitAction = new QAction("Quit", this);
         connect(quitAction, &QAction::triggered, qApp, &QApplication::quit);
@@ -166,25 +302,44 @@ private:
         trayMenu->addAction(showAction);
         trayMenu->addSeparator();
         trayMenu->addAction(quitAction);
+    }
 
-        trayIcon->setContextMenu(trayMenu);
+    void hideToTray()
+    {
+        hide();
+        if (releaseWhenHidden)
+        {
+            // not from inside the event that hid us
+            QTimer::singleShot(0, this, [this]()
+                               {
+                if (!isVisible())
+                    releaseUI(); });
+        }
+    }
 
-        connect(trayIcon, &QSystemTrayIcon::activated, [this](QSystemTrayIcon::ActivationReason reason)
-                {
-            if (reason == QSystemTrayIcon::DoubleClick) {
-                showNormal();
-                raise();
-                activateWindow();
-            } });
+    // everything but the model and the tray icon; showWindow builds it again from the model
+    void releaseUI()
+    {
+        if (!songLabel)
+            return;
 
-        trayIcon->show();
+        const size_t before = workingSetBytes();
+        delete takeCentralWidget();
+        songLabel = nullptr;
+        artworkLabel = nullptr;
+        statsLabel = nullptr;
+        stats.Clear();
+        defaultArtwork = QPixmap();
+        destroy(); // native window and backing store
+        qInfo("tray-only: released window, working set %llu KB -> %llu KB",
+              static_cast<unsigned long long>(before / 1024), static_cast<unsigned long long>(workingSetBytes() / 1024));
     }
 
     void closeEvent(QCloseEvent *event) override
     {
-        if (trayIcon->isVisible())
+        if (trayIcon && trayIcon->isVisible())
         {
-            hide();
+            hideToTray();
             event->ignore();
         }
     }
@@ -195,7 +350,7 @@ private:
         {
             if (isMinimized())
             {
-                hide();
+                hideToTray();
                 event->ignore();
             }
         }
@@ -204,126 +359,279 @@ private:
 
     void pollDiscord()
     {
+        // single shot, each tick picks when the next one happens
+        discordTimer->setSingleShot(true);
         connect(discordTimer, &QTimer::timeout, [this]()
                 {
-            updateDiscordPresence();
-            Discord_RunCallbacks(); });
-        discordTimer->start(500); // poll this so discord prescence updates
+            TraceSpan span("poll");
+            const MusicInfo music = getMusicBeeInfo(ipcClient);
+            // the pipeline fetches and hashes the cover for the overlay and the window alike; the
+            // window only asks for it when it has no thumbnail of the track
+            const bool artworkKnown = showKnownArtwork(music);
+            const std::shared_ptr<const NowPlaying> now = pipeline.Publish(music, ipcClient, !artworkKnown);
+            updateNowPlaying(*now);
+            Discord_RunCallbacks();
+            if (songLabel && loggedPlays() != stats.PlayCount())
+            {
+                refreshStats();
+                render();
+            }
+            scheduleNextPoll(now->music); });
+        pollStatsTimer.start();
+        discordTimer->start(0);
     }
 
-    void updateDiscordPresence()
+    void scheduleNextPoll(const MusicInfo &music)
     {
-        MusicInfo music = getMusicBeeInfo();
-        DiscordRichPresence discordPresence;
-        memset(&discordPresence, 0, sizeof(discordPresence));
+        const PollScheduler::State state = pollState(music);
+        countPollTick(state);
+        discordTimer->start(pollScheduler.NextIntervalMs(state, music.positionMs, music.durationMs));
 
-        if (music.isPlaying && !music.title.empty())
+        if (!markedFirstPresence)
         {
-            updatePlayingState(discordPresence, music);
+            markStartup("first presence");
+            markedFirstPresence = true;
         }
-        else
+
+        if (pollStatsTimer.hasExpired(POLL_STATS_INTERVAL_MS))
         {
-            updateIdleState(discordPresence);
+            std::chrono::steady_clock::duration elapsed;
+            PollScheduler::Stats stats = pollScheduler.TakeStats(&elapsed);
+            pollStatsTimer.restart();
+            qInfo("%s", describePollStats(stats, elapsed).c_str());
         }
-
-        Discord_UpdatePresence(&discordPresence);
     }
 
-    void updatePlayingState(DiscordRichPresence &presence, const MusicInfo &music)
+    // read off an atomic, so a history sink stuck in a flush never holds up the tick; the log
+    // itself is only read once this has moved
+    size_t loggedPlays() const
     {
-        // update discord presence
-        currentDetails = "♪ " + music.title;
-        currentState = "by " + music.artist;
-        presence.details = currentDetails.c_str();
-        presence.state = currentState.c_str();
-        presence.largeImageKey = "music";
-        presence.largeImageText = "Listening to music";
-
-        // update UI
-        QString labelText = QString("🎧 %1 - %2")
-                                .arg(QString::fromStdString(music.title))
-                                .arg(QString::fromStdString(music.artist));
-        songLabel->setText(labelText);
-        updateArtwork(music.artworkPath);
+        return historySink ? historySink->PlayCount() : 0;
     }
 
-    void updateIdleState(DiscordRichPresence &presence)
+    // the window's side of a tick; Discord and the rest get it through the pipeline
+    void updateNowPlaying(const NowPlaying &now)
     {
-        presence.details = DISCORD_DETAILS;
-        presence.state = DISCORD_STATE;
-        presence.largeImageKey = DISCORD_LARGE_IMAGE_KEY;
-        presence.largeImageText = DISCORD_LARGE_IMAGE_TEXT;
+        // the label and cover are what they were; nothing to build. render still picks up a
+        // thumbnail showKnownArtwork may have put in the model this tick
+        if (!now.changed)
+        {
+            render();
+            return;
+        }
 
-        songLabel->setText("🎧 DiscordMusicBee - waiting for song...");
-        setDefaultArtwork();
+        const MusicInfo &music = now.music;
+        if (music.isPlaying && !music.title.empty())
+        {
+            QString labelText = QString("🎧 %1 - %2")
+                                    .arg(QString::fromUtf8(music.title.data(), static_cast<int>(music.title.size())))
+                                    .arg(QString::fromUtf8(music.artist.data(), static_cast<int>(music.artist.size())));
+            model.SetSongText(labelText);
+            updateArtwork(now);
+        }
+        else
+        {
+            model.SetSongText("🎧 DiscordMusicBee - waiting for song...");
+            resetArtwork();
+        }
+
+        render();
     }
 
-    void setDefaultArtwork()
+    void resetArtwork()
     {
-        QPixmap icon(":/icon.png");
+        artworkLoader->cancel();
+        artworkFileUrl.clear();
+        requestedArtworkKey = 0;
+        model.SetDefaultArtwork();
+    }
 
-        if (!icon.isNull())
+    // memory first, then the thumbnails left on disk by earlier runs; null if neither has it
+    QImage findCachedArtwork(uint64_t key)
+    {
+        if (const QImage *cached = artworkCache.Find(key))
         {
-            QPixmap scaled = icon.scaled(150, 150, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            artworkLabel->setPixmap(scaled);
+            countArtworkLookup(ArtworkLookup::Memory);
+            return *cached;
         }
-        else
+
+        QImage thumbnail = thumbnailCache.Load(key);
+        if (!thumbnail.isNull())
         {
-            artworkLabel->clear();
+            thumbnail.setDevicePixelRatio(devicePixelRatioF()); // png doesn't keep it; the key implies it
+            artworkCache.Insert(key, thumbnail);
         }
+        countArtworkLookup(thumbnail.isNull() ? ArtworkLookup::Miss : ArtworkLookup::Disk);
+        return thumbnail;
+    }
+
+    // artwork is rendered at the display's scale, so anything cached from it has to say which.
+    // 1x keeps the plain keys and urls, so thumbnails from earlier runs still match
+    int artworkPixelSize() const
+    {
+        return qRound(ARTWORK_SIZE * devicePixelRatioF());
+    }
+
+    // the pipeline's hash of the cover's bytes, told apart per display scale without hashing
+    // the cover again
+    uint64_t artworkKey(uint64_t artworkHash) const
+    {
+        const int pixels = artworkPixelSize();
+        return pixels == ARTWORK_SIZE ? artworkHash : ArtworkCache::Key(&artworkHash, sizeof(artworkHash), pixels);
     }
 
-    void updateArtwork(const std::string &artworkPath)
+    std::string thumbnailUrl(std::string_view fileUrl) const
     {
-        if (artworkPath.empty())
+        const int pixels = artworkPixelSize();
+        std::string url(fileUrl);
+        if (url.empty() || pixels == ARTWORK_SIZE)
+            return url;
+        return url + "@" + std::to_string(pixels);
+    }
+
+    void showCachedArtwork(uint64_t key, const QImage &image)
+    {
+        artworkLoader->cancel();
+        model.SetArtwork(key, image);
+    }
+
+    // Before the tick is published: true if the window needs nothing fetched for the track's
+    // cover, because it's showing it already, its thumbnail is on disk from before, or nothing's
+    // playing
+    bool showKnownArtwork(const MusicInfo &music)
+    {
+        if (!music.isPlaying || music.title.empty())
+            return true;
+        if (!music.fileUrl.empty() && music.fileUrl == artworkFileUrl)
+            return true;
+        // a stream: nothing on disk is named after it, the pipeline keeps its cover per title
+        if (music.fileUrl.empty())
+            return false;
+
+        TraceSpan span("artwork.lookup");
+        uint64_t key = 0;
+        if (thumbnailCache.FindKey(thumbnailUrl(music.fileUrl), &key))
         {
-            setDefaultArtwork();
-            return;
+            QImage cached = findCachedArtwork(key);
+            if (!cached.isNull())
+            {
+                showCachedArtwork(key, cached);
+                artworkFileUrl = music.fileUrl;
+                requestedArtworkKey = key;
+                return true;
+            }
         }
+        return false;
+    }
 
-        QString artworkData = QString::fromStdString(artworkPath);
+    // after it's published, with the cover the pipeline fetched for it, if showKnownArtwork
+    // didn't already have one
+    void updateArtwork(const NowPlaying &now)
+    {
+        const MusicInfo &music = now.music;
+        if (!music.fileUrl.empty() && music.fileUrl == artworkFileUrl)
+            return;
 
-        // is base64
-        if (artworkData.length() <= 150 || !artworkData.contains("/"))
+        // none yet; the pipeline asks again next tick, musicbee may still be downloading it
+        if (!now.derived->artwork)
         {
-            setDefaultArtwork();
+            resetArtwork();
             return;
         }
 
-        QByteArray imageData = QByteArray::fromBase64(artworkData.toUtf8());
-        QPixmap artwork;
+        const uint64_t key = artworkKey(now.derived->artworkHash);
+        const bool sameCover = key == requestedArtworkKey;
+        // a stream showing this cover already: there's no url to remember it under
+        if (sameCover && music.fileUrl.empty())
+            return;
+        artworkFileUrl = music.fileUrl;
+        requestedArtworkKey = key;
 
-        if (artwork.loadFromData(imageData))
+        // the next track off the same album: nothing to decode, but it's remembered under this
+        // track's url too, so its later ticks don't fetch the cover again. still decoding, the
+        // loader's result is stored under this url when it arrives
+        if (sameCover)
         {
-            QPixmap scaled = artwork.scaled(150, 150, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            QPixmap rounded = createRoundedPixmap(scaled, 10);
-            artworkLabel->setPixmap(rounded);
+            if (const QImage *shown = artworkCache.Find(key))
+                thumbnailCache.Store(key, thumbnailUrl(music.fileUrl), *shown);
+            return;
         }
-        else
+
+        // seen this cover before (album tracks repeat it), no decode at all
+        QImage cached = findCachedArtwork(key);
+        if (!cached.isNull())
         {
-            setDefaultArtwork();
+            showCachedArtwork(key, cached);
+            if (!music.fileUrl.empty())
+                thumbnailCache.Store(key, thumbnailUrl(music.fileUrl), cached);
+            return;
         }
+
+        // decode, scale and round on the loader's thread, the label is updated when it's done
+        artworkLoader->request(key, now.derived->artwork, ARTWORK_SIZE, ARTWORK_RADIUS, devicePixelRatioF());
     }
 };
 
-void setupDiscord()
+static bool hasArgument(int argc, char *argv[], const char *name)
 {
-    DiscordEventHandlers handlers;
-    memset(&handlers, 0, sizeof(handlers));
-    Discord_Initialize(DISCORD_APP_ID.c_str(), &handlers, 1, NULL);
-
-    // Initial presence update will happen in pollDiscord timer
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], name) == 0)
+            return true;
+    }
+    return false;
 }
 
 int main(int argc, char *argv[])
 {
+    // reads the history and exits, nothing else starts
+    if (hasArgument(argc, argv, "--stats"))
+        return printHistoryStats(HistoryLog::PathFromArgs(argc, argv));
+
+    markStartup("main");
+    startTraceFromArgs(argc, argv);
+    if (!startMetricsFromArgs(argc, argv))
+        qWarning("metrics: couldn't listen on the given address");
+    if (!startOverlayFromArgs(argc, argv))
+        qWarning("overlay: couldn't listen on the given address");
+
+    // the bridge loop only, before any of qt is touched
+    if (hasArgument(argc, argv, "--headless"))
+        return runHeadless(HistoryLog::PathFromArgs(argc, argv), TextFileSink::PathFromArgs(argc, argv));
+    const bool trayOnly = hasArgument(argc, argv, "--tray-only");
+    traceThreadName("gui");
+
     setupDiscord();
+    markStartup("discord");
 
     QApplication app(argc, argv);
-    MainWindow window;
-    window.show();
-
-    int result = app.exec();
+    if (trayOnly)
+        app.setQuitOnLastWindowClosed(false); // only the tray's quit action ends it
+    markStartup("qapplication");
+    int result = 0;
+    {
+        MainWindow window(HistoryLog::PathFromArgs(argc, argv), TextFileSink::PathFromArgs(argc, argv));
+        markStartup("bridge");
+
+        // queued behind the first poll, so the presence goes out before any widget is built
+        QTimer::singleShot(0, &window, [&window, trayOnly]()
+                           {
+            if (trayOnly)
+                window.showTrayOnly();
+            else
+                window.showWindow();
+            markStartup(trayOnly ? "tray" : "window");
+            qInfo("%s", describeStartup().c_str()); });
+
+        result = app.exec();
+        window.stopSinks();
+    }
+    // the window took its artwork loader and thumbnail writer pools with it, waiting for both; like
+    // every other thread that records spans they're done before the trace is written
+    stopOverlay();
+    stopMetrics();
     Discord_Shutdown();
+    if (traceEnabled() && !writeTrace())
+        qWarning("trace: couldn't write the trace file");
     return result;
 }
@@ -1,170 +1,170 @@
 #include "musicbee_ipc.h"
-#include <vector>
-
-#define WM_USER 0x0400
-constexpr size_t CSHARP_LONG_SIZE = 8; // C# long is 64-bit, not 32-bit like C++ long on Windows
+#include "trace.h"
+#include <cstdint>
+#include <cstring>
 
 namespace
 {
-    constexpr unsigned short MMF_ID_MASK = 0xFFFF;
-    constexpr int OFFSET_SHIFT = 16;
+    constexpr size_t CSHARP_LONG_SIZE = 8; // C# long is 64-bit, not 32-bit like C++ long on Windows
+    constexpr size_t SHARED_HEADER = CSHARP_LONG_SIZE + sizeof(int32_t);
 
-    class ScopedHandle
+    void encodeCodePoint(char *out, uint32_t cp, size_t bytes)
     {
-        HANDLE handle;
-
-    public:
-        explicit ScopedHandle(HANDLE h) : handle(h) {}
-        ~ScopedHandle()
+        switch (bytes)
         {
-            if (handle && handle != INVALID_HANDLE_VALUE)
-                CloseHandle(handle);
+        case 1:
+            out[0] = static_cast<char>(cp);
+            break;
+        case 2:
+            out[0] = static_cast<char>(0xC0 | (cp >> 6));
+            out[1] = static_cast<char>(0x80 | (cp & 0x3F));
+            break;
+        case 3:
+            out[0] = static_cast<char>(0xE0 | (cp >> 12));
+            out[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out[2] = static_cast<char>(0x80 | (cp & 0x3F));
+            break;
+        default:
+            out[0] = static_cast<char>(0xF0 | (cp >> 18));
+            out[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out[3] = static_cast<char>(0x80 | (cp & 0x3F));
+            break;
         }
+    }
 
-        operator HANDLE() const { return handle; }
-        bool IsValid() const { return handle && handle != INVALID_HANDLE_VALUE; }
-
-        ScopedHandle(const ScopedHandle &) = delete;
-        ScopedHandle &operator=(const ScopedHandle &) = delete;
-    };
-
-    class ScopedMapView
+    // unit(i) is the i-th UTF-16 code unit. Stops at a nul, as WideCharToMultiByte did, and
+    // before a code point that doesn't fit in capacity. out may be null to only count the bytes.
+    template <typename Unit>
+    size_t utf16ToUtf8(const Unit &unit, size_t length, char *out, size_t capacity)
     {
-        LPVOID view;
-
-    public:
-        explicit ScopedMapView(LPVOID v) : view(v) {}
-        ~ScopedMapView()
+        size_t written = 0;
+        for (size_t i = 0; i < length; ++i)
         {
-            if (view)
-                UnmapViewOfFile(view);
+            uint32_t cp = unit(i);
+            if (cp == 0)
+                break;
+
+            size_t bytes = 1;
+            if (cp >= 0x80)
+            {
+                if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < length && unit(i + 1) >= 0xDC00 && unit(i + 1) <= 0xDFFF)
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (unit(i + 1) - 0xDC00);
+                    ++i;
+                }
+                else if (cp >= 0xD800 && cp <= 0xDFFF)
+                {
+                    cp = 0xFFFD;
+                }
+                bytes = cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+            }
+
+            if (capacity - written < bytes)
+                break;
+            if (out)
+                encodeCodePoint(out + written, cp, bytes);
+            written += bytes;
         }
+        return written;
+    }
 
-        operator LPVOID() const { return view; }
-        bool IsValid() const { return view != nullptr; }
-
-        ScopedMapView(const ScopedMapView &) = delete;
-        ScopedMapView &operator=(const ScopedMapView &) = delete;
-    };
-}
-
-bool MusicBeeIPC::Connect()
-{
-    ipcWindow = FindWindowW(nullptr, L"MusicBee IPC Interface");
-    if (!ipcWindow)
-        return false;
-
-    // Test connection with Probe command (should return 1 for NoError)
-    LRESULT result = SendMessageW(ipcWindow, WM_USER, static_cast<WPARAM>(MBCommand::Probe), 0);
-    return result == 1;
-}
-
-void MusicBeeIPC::Disconnect()
-{
-    ipcWindow = nullptr;
-}
-
-bool MusicBeeIPC::IsConnected() const
-{
-    return ipcWindow != nullptr && IsWindow(ipcWindow);
-}
-
-MBPlayState MusicBeeIPC::GetPlayState()
-{
-    if (!IsConnected())
-        return MBPlayState::Undefined;
-
-    LRESULT result = SendMessageW(ipcWindow, WM_USER, static_cast<WPARAM>(MBCommand::GetPlayState), 0);
-    return static_cast<MBPlayState>(result);
-}
-
-std::string MusicBeeIPC::GetFileTag(MBMetaDataType tagType)
-{
-    if (!IsConnected())
-        return "";
+    template <typename Unit>
+    std::string utf16ToUtf8(const Unit &unit, size_t length)
+    {
+        // counted first, so a cover's megabytes of base64 get exactly the one buffer
+        std::string out(utf16ToUtf8(unit, length, nullptr, SIZE_MAX), '\0');
+        if (!out.empty())
+            utf16ToUtf8(unit, length, &out[0], out.size());
+        return out;
+    }
 
-    LRESULT lr = SendMessageW(ipcWindow, WM_USER, static_cast<WPARAM>(MBCommand::GetFileTag), static_cast<LPARAM>(tagType));
-    if (lr == 0)
-        return "";
+    // the UTF-16 LE text of MusicBee's string at offset, read in place: past the header the view
+    // is only byte aligned. false if it doesn't fit inside viewSize
+    bool sharedText(const void *view, size_t viewSize, size_t offset, const unsigned char **text, size_t *units)
+    {
+        if (!view || offset > viewSize || viewSize - offset < SHARED_HEADER)
+            return false;
+
+        // Data format: [CSHARP_LONG_SIZE capacity] [int32 byteCount] [UTF-16 LE string]
+        const unsigned char *dataPtr = static_cast<const unsigned char *>(view) + offset + CSHARP_LONG_SIZE;
+        int32_t byteCount;
+        memcpy(&byteCount, dataPtr, sizeof(byteCount));
+        if (byteCount <= 0 || static_cast<size_t>(byteCount) > viewSize - offset - SHARED_HEADER)
+            return false;
+
+        *text = dataPtr + sizeof(byteCount);
+        *units = static_cast<size_t>(byteCount) / sizeof(char16_t);
+        return true;
+    }
 
-    std::string result = ReadStringFromSharedMemory(lr);
-    FreeSharedMemory(lr);
-    return result;
+    struct LittleEndianUnits
+    {
+        const unsigned char *bytes;
+        uint32_t operator()(size_t i) const { return bytes[2 * i] | (static_cast<uint32_t>(bytes[2 * i + 1]) << 8); }
+    };
 }
 
-std::string MusicBeeIPC::GetArtwork()
+std::string MusicBeeIPC::DecodeSharedString(const void *view, size_t viewSize, size_t offset)
 {
-    if (!IsConnected())
+    TraceSpan span("ipc.decode");
+    const unsigned char *text;
+    size_t units;
+    if (!sharedText(view, viewSize, offset, &text, &units))
         return "";
-
-    // Try commands in priority order: embedded → external → URL
-    std::string result = TryGetArtworkCommand(MBCommand::GetDownloadedArtwork);
-    if (!result.empty())
-        return result;
-
-    result = TryGetArtworkCommand(MBCommand::GetArtwork);
-    if (!result.empty())
-        return result;
-
-    return TryGetArtworkCommand(MBCommand::GetArtworkUrl);
+    return utf16ToUtf8(LittleEndianUnits{text}, units);
 }
 
-std::wstring MusicBeeIPC::GetMMFName(unsigned short mmfId) const
+size_t MusicBeeIPC::DecodeSharedString(const void *view, size_t viewSize, size_t offset, char *out, size_t capacity)
 {
-    return L"mbipc_mmf_" + std::to_wstring(mmfId);
+    TraceSpan span("ipc.decode");
+    const unsigned char *text;
+    size_t units;
+    if (!sharedText(view, viewSize, offset, &text, &units))
+        return 0;
+    return utf16ToUtf8(LittleEndianUnits{text}, units, out, capacity);
 }
 
-std::string MusicBeeIPC::TryGetArtworkCommand(MBCommand command)
+std::string MusicBeeIPC::Utf16ToUtf8(const char16_t *text, size_t length)
 {
-    LRESULT lr = SendMessageW(ipcWindow, WM_USER, static_cast<WPARAM>(command), 0);
-    if (lr == 0)
-        return "";
-
-    std::string result = ReadStringFromSharedMemory(lr);
-    FreeSharedMemory(lr);
-    return result;
+    return utf16ToUtf8([text](size_t i) -> uint32_t
+                       { return text[i]; },
+                       length);
 }
 
-std::string MusicBeeIPC::ReadStringFromSharedMemory(LRESULT lr)
+std::string MusicBeeIPC::DecodeArtwork(const std::string &artwork)
 {
-    // LRESULT encoding: low 2 bytes = MMF ID, high 2 bytes = offset
-    unsigned short mmfId = lr & MMF_ID_MASK;
-    unsigned short offset = (lr >> OFFSET_SHIFT) & MMF_ID_MASK;
-
-    // Open memory-mapped file
-    std::wstring mmfName = GetMMFName(mmfId);
-    ScopedHandle hMapFile(OpenFileMappingW(FILE_MAP_READ, FALSE, mmfName.c_str()));
-    if (!hMapFile.IsValid())
-        return "";
-
-    // Map view of file
-    ScopedMapView pBuf(MapViewOfFile(hMapFile, FILE_MAP_READ, 0, 0, 0));
-    if (!pBuf.IsValid())
-        return "";
-
-    // Data format: [CSHARP_LONG_SIZE capacity] [int32 byteCount] [UTF-16 LE string]
-    char *dataPtr = static_cast<char *>(static_cast<LPVOID>(pBuf)) + offset + CSHARP_LONG_SIZE;
-    int byteCount = *reinterpret_cast<int *>(dataPtr);
-    dataPtr += sizeof(int);
-
-    // Read UTF-16 LE string
-    std::wstring wstr(reinterpret_cast<wchar_t *>(dataPtr), byteCount / sizeof(wchar_t));
-
-    // Convert to UTF-8
-    if (wstr.empty())
-        return "";
-
-    int utf8Length = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, nullptr, 0, nullptr, nullptr);
-    std::vector<char> utf8Buffer(utf8Length);
-    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), -1, utf8Buffer.data(), utf8Length, nullptr, nullptr);
-
-    return std::string(utf8Buffer.data());
-}
-
-void MusicBeeIPC::FreeSharedMemory(LRESULT lr)
-{
-    if (IsConnected() && lr != 0)
+    std::string out;
+    out.reserve(artwork.size() / 4 * 3);
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (const char c : artwork)
     {
-        SendMessageW(ipcWindow, WM_USER, static_cast<WPARAM>(MBCommand::FreeLRESULT), lr);
+        int value;
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if (c == '+')
+            value = 62;
+        else if (c == '/')
+            value = 63;
+        else if (c == '=')
+            break;
+        else if (c == '\r' || c == '\n' || c == ' ')
+            continue;
+        else
+            return ""; // a path or url, from GetArtworkUrl
+
+        bits = (bits << 6) | static_cast<uint32_t>(value);
+        bitCount += 6;
+        if (bitCount >= 8)
+        {
+            bitCount -= 8;
+            out += static_cast<char>((bits >> bitCount) & 0xFF);
+        }
     }
+    return out;
 }
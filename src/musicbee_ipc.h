@@ -1,12 +1,20 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
-#include <windows.h>
+#include "inline_string.h"
 
-// IPC Commands
-enum class MBCommand : WPARAM
+// The transport (window messages + memory-mapped files) is in musicbee_ipc_win.cpp; elsewhere
+// musicbee_ipc_stub.cpp never connects. Decoding what MusicBee writes is portable.
+
+// IPC Commands (a WPARAM)
+enum class MBCommand : uintptr_t
 {
     GetPlayState = 109,
+    GetPosition = 110,
+    GetDuration = 139,
+    GetFileUrl = 140,
     GetFileTag = 142,
     GetArtwork = 145,
     GetArtworkUrl = 146,
@@ -25,8 +33,8 @@ enum class MBPlayState : int
     Stopped = 7
 };
 
-// MetaDataType
-enum class MBMetaDataType : LPARAM
+// MetaDataType (an LPARAM)
+enum class MBMetaDataType : intptr_t
 {
     TrackTitle = 65,
     Album = 30,
@@ -44,14 +52,33 @@ public:
     bool IsConnected() const;
 
     MBPlayState GetPlayState();
-    std::string GetFileTag(MBMetaDataType tagType);
+    int GetPosition(); // ms, -1 if unknown
+    int GetDuration(); // ms, -1 if unknown
+    // decoded straight into out, at most capacity bytes cut at a code point; the bytes written
+    size_t GetFileUrl(char *out, size_t capacity);
+    size_t GetFileTag(MBMetaDataType tagType, char *out, size_t capacity);
     std::string GetArtwork();
 
+    template <size_t N>
+    void GetFileUrl(InlineString<N> &out) { out.resize(GetFileUrl(out.buffer(), N)); }
+    template <size_t N>
+    void GetFileTag(MBMetaDataType tagType, InlineString<N> &out) { out.resize(GetFileTag(tagType, out.buffer(), N)); }
+
+    // A string as MusicBee leaves it in a mapped view: [C# long capacity][int32 byteCount][UTF-16 LE]
+    // starting at offset. Empty if it doesn't fit inside viewSize.
+    static std::string DecodeSharedString(const void *view, size_t viewSize, size_t offset);
+    // the same into out, at most capacity bytes cut at a code point; the bytes written
+    static size_t DecodeSharedString(const void *view, size_t viewSize, size_t offset, char *out, size_t capacity);
+    // unpaired surrogates become U+FFFD
+    static std::string Utf16ToUtf8(const char16_t *text, size_t length);
+    // GetArtwork's base64 as the image file's bytes; empty when it's a path or url instead
+    static std::string DecodeArtwork(const std::string &artwork);
+
 private:
-    HWND ipcWindow;
+    void *ipcWindow; // HWND
 
-    std::wstring GetMMFName(unsigned short mmfId) const;
-    std::string ReadStringFromSharedMemory(LRESULT lr);
-    void FreeSharedMemory(LRESULT lr);
+    std::string ReadStringFromSharedMemory(intptr_t lr);
+    size_t ReadStringFromSharedMemory(intptr_t lr, char *out, size_t capacity);
+    void FreeSharedMemory(intptr_t lr);
     std::string TryGetArtworkCommand(MBCommand command);
 };
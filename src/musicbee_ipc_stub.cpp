@@ -0,0 +1,49 @@
+#include "musicbee_ipc.h"
+
+// MusicBee only runs on Windows; elsewhere the bridge builds and runs but never finds it, so the
+// poll backs off as if MusicBee were closed.
+
+bool MusicBeeIPC::Connect()
+{
+    return false;
+}
+
+void MusicBeeIPC::Disconnect()
+{
+    ipcWindow = nullptr;
+}
+
+bool MusicBeeIPC::IsConnected() const
+{
+    return false;
+}
+
+MBPlayState MusicBeeIPC::GetPlayState()
+{
+    return MBPlayState::Undefined;
+}
+
+int MusicBeeIPC::GetPosition()
+{
+    return -1;
+}
+
+int MusicBeeIPC::GetDuration()
+{
+    return -1;
+}
+
+size_t MusicBeeIPC::GetFileUrl(char *, size_t)
+{
+    return 0;
+}
+
+size_t MusicBeeIPC::GetFileTag(MBMetaDataType, char *, size_t)
+{
+    return 0;
+}
+
+std::string MusicBeeIPC::GetArtwork()
+{
+    return "";
+}
@@ -0,0 +1,222 @@
+#include "musicbee_ipc.h"
+#include "metrics.h"
+#include "trace.h"
+#include <cwchar>
+#include <windows.h>
+
+namespace
+{
+    constexpr unsigned short MMF_ID_MASK = 0xFFFF;
+    constexpr int OFFSET_SHIFT = 16;
+
+    class ScopedHandle
+    {
+        HANDLE handle;
+
+    public:
+        explicit ScopedHandle(HANDLE h) : handle(h) {}
+        ~ScopedHandle()
+        {
+            if (handle && handle != INVALID_HANDLE_VALUE)
+                CloseHandle(handle);
+        }
+
+        operator HANDLE() const { return handle; }
+        bool IsValid() const { return handle && handle != INVALID_HANDLE_VALUE; }
+
+        ScopedHandle(const ScopedHandle &) = delete;
+        ScopedHandle &operator=(const ScopedHandle &) = delete;
+    };
+
+    class ScopedMapView
+    {
+        LPVOID view;
+
+    public:
+        explicit ScopedMapView(LPVOID v) : view(v) {}
+        ~ScopedMapView()
+        {
+            if (view)
+                UnmapViewOfFile(view);
+        }
+
+        operator LPVOID() const { return view; }
+        bool IsValid() const { return view != nullptr; }
+
+        ScopedMapView(const ScopedMapView &) = delete;
+        ScopedMapView &operator=(const ScopedMapView &) = delete;
+    };
+
+    HWND window(void *ipcWindow)
+    {
+        return static_cast<HWND>(ipcWindow);
+    }
+
+    // the view an LRESULT points into: low 2 bytes the MMF id, high 2 bytes the string's offset
+    class SharedView
+    {
+    public:
+        explicit SharedView(intptr_t lr) : mapFile(openMapping(static_cast<unsigned short>(lr & MMF_ID_MASK))),
+                                           view(mapFile.IsValid() ? MapViewOfFile(mapFile, FILE_MAP_READ, 0, 0, 0) : nullptr),
+                                           offset((lr >> OFFSET_SHIFT) & MMF_ID_MASK)
+        {
+            // how much of it is actually mapped, so a bad byte count can't read past the view
+            MEMORY_BASIC_INFORMATION region;
+            if (view.IsValid() && VirtualQuery(view, &region, sizeof(region)))
+                size = region.RegionSize;
+        }
+
+        const void *Data() const { return size ? static_cast<LPVOID>(view) : nullptr; }
+        size_t Size() const { return size; }
+        size_t Offset() const { return offset; }
+
+    private:
+        ScopedHandle mapFile;
+        ScopedMapView view;
+        size_t offset;
+        size_t size = 0;
+
+        static HANDLE openMapping(unsigned short mmfId)
+        {
+            wchar_t name[32]; // on the stack, this runs for every tag of every poll
+            swprintf(name, sizeof(name) / sizeof(name[0]), L"mbipc_mmf_%u", static_cast<unsigned>(mmfId));
+            return OpenFileMappingW(FILE_MAP_READ, FALSE, name);
+        }
+    };
+}
+
+bool MusicBeeIPC::Connect()
+{
+    TraceSpan span("ipc.Connect");
+    IpcTimer timer(IpcCommand::Connect);
+    ipcWindow = FindWindowW(nullptr, L"MusicBee IPC Interface");
+    if (!ipcWindow)
+        return false;
+
+    // Test connection with Probe command (should return 1 for NoError)
+    LRESULT result = SendMessageW(window(ipcWindow), WM_USER, static_cast<WPARAM>(MBCommand::Probe), 0);
+    return result == 1;
+}
+
+void MusicBeeIPC::Disconnect()
+{
+    ipcWindow = nullptr;
+}
+
+bool MusicBeeIPC::IsConnected() const
+{
+    return ipcWindow != nullptr && IsWindow(window(ipcWindow));
+}
+
+MBPlayState MusicBeeIPC::GetPlayState()
+{
+    TraceSpan span("ipc.GetPlayState");
+    IpcTimer timer(IpcCommand::GetPlayState);
+    if (!IsConnected())
+        return MBPlayState::Undefined;
+
+    LRESULT result = SendMessageW(window(ipcWindow), WM_USER, static_cast<WPARAM>(MBCommand::GetPlayState), 0);
+    return static_cast<MBPlayState>(result);
+}
+
+int MusicBeeIPC::GetPosition()
+{
+    TraceSpan span("ipc.GetPosition");
+    IpcTimer timer(IpcCommand::GetPosition);
+    if (!IsConnected())
+        return -1;
+
+    return static_cast<int>(SendMessageW(window(ipcWindow), WM_USER, static_cast<WPARAM>(MBCommand::GetPosition), 0));
+}
+
+int MusicBeeIPC::GetDuration()
+{
+    TraceSpan span("ipc.GetDuration");
+    IpcTimer timer(IpcCommand::GetDuration);
+    if (!IsConnected())
+        return -1;
+
+    return static_cast<int>(SendMessageW(window(ipcWindow), WM_USER, static_cast<WPARAM>(MBCommand::GetDuration), 0));
+}
+
+size_t MusicBeeIPC::GetFileUrl(char *out, size_t capacity)
+{
+    TraceSpan span("ipc.GetFileUrl");
+    IpcTimer timer(IpcCommand::GetFileUrl);
+    if (!IsConnected())
+        return 0;
+
+    LRESULT lr = SendMessageW(window(ipcWindow), WM_USER, static_cast<WPARAM>(MBCommand::GetFileUrl), 0);
+    if (lr == 0)
+        return 0;
+
+    size_t result = ReadStringFromSharedMemory(lr, out, capacity);
+    FreeSharedMemory(lr);
+    return result;
+}
+
+size_t MusicBeeIPC::GetFileTag(MBMetaDataType tagType, char *out, size_t capacity)
+{
+    TraceSpan span("ipc.GetFileTag");
+    IpcTimer timer(IpcCommand::GetFileTag);
+    if (!IsConnected())
+        return 0;
+
+    LRESULT lr = SendMessageW(window(ipcWindow), WM_USER, static_cast<WPARAM>(MBCommand::GetFileTag), static_cast<LPARAM>(tagType));
+    if (lr == 0)
+        return 0;
+
+    size_t result = ReadStringFromSharedMemory(lr, out, capacity);
+    FreeSharedMemory(lr);
+    return result;
+}
+
+std::string MusicBeeIPC::GetArtwork()
+{
+    TraceSpan span("ipc.GetArtwork");
+    IpcTimer timer(IpcCommand::GetArtwork);
+    if (!IsConnected())
+        return "";
+
+    // Try commands in priority order: embedded → external → URL
+    std::string result = TryGetArtworkCommand(MBCommand::GetDownloadedArtwork);
+    if (!result.empty())
+        return result;
+
+    result = TryGetArtworkCommand(MBCommand::GetArtwork);
+    if (!result.empty())
+        return result;
+
+    return TryGetArtworkCommand(MBCommand::GetArtworkUrl);
+}
+
+std::string MusicBeeIPC::TryGetArtworkCommand(MBCommand command)
+{
+    LRESULT lr = SendMessageW(window(ipcWindow), WM_USER, static_cast<WPARAM>(command), 0);
+    if (lr == 0)
+        return "";
+
+    std::string result = ReadStringFromSharedMemory(lr);
+    FreeSharedMemory(lr);
+    return result;
+}
+
+std::string MusicBeeIPC::ReadStringFromSharedMemory(intptr_t lr)
+{
+    SharedView view(lr);
+    return DecodeSharedString(view.Data(), view.Size(), view.Offset());
+}
+
+size_t MusicBeeIPC::ReadStringFromSharedMemory(intptr_t lr, char *out, size_t capacity)
+{
+    SharedView view(lr);
+    return DecodeSharedString(view.Data(), view.Size(), view.Offset(), out, capacity);
+}
+
+void MusicBeeIPC::FreeSharedMemory(intptr_t lr)
+{
+    if (IsConnected() && lr != 0)
+    {
+        SendMessageW(window(ipcWindow), WM_USER, static_cast<WPARAM>(MBCommand::FreeLRESULT), lr);
+    }
+}
@@ -0,0 +1,33 @@
+#include "now_playing_model.h"
+
+void NowPlayingModel::SetSongText(const QString &text)
+{
+    if (text == songText)
+        return;
+    songText = text;
+    dirty |= SongText;
+}
+
+void NowPlayingModel::SetArtwork(uint64_t key, const QImage &image)
+{
+    if (key == artworkKey)
+        return;
+    artworkKey = key;
+    artwork = image;
+    dirty |= Artwork;
+}
+
+void NowPlayingModel::SetStatsText(const QString &text)
+{
+    if (text == statsText)
+        return;
+    statsText = text;
+    dirty |= StatsText;
+}
+
+unsigned NowPlayingModel::TakeDirty()
+{
+    unsigned changed = dirty;
+    dirty = 0;
+    return changed;
+}
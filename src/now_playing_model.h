@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QImage>
+#include <QString>
+#include <cstdint>
+
+// What the window should be showing, kept apart from the widgets so a poll tick that changes
+// nothing doesn't touch (and repaint) them. Setters only mark a field dirty when its value
+// actually changes; the window applies whatever TakeDirty() returns.
+class NowPlayingModel
+{
+public:
+    enum Field : unsigned
+    {
+        SongText = 1u << 0,
+        Artwork = 1u << 1,
+        StatsText = 1u << 2,
+    };
+
+    // artwork key for the app icon shown when there's no cover
+    static constexpr uint64_t DEFAULT_ARTWORK = 0;
+
+    void SetSongText(const QString &text);
+    // key identifies the image (an ArtworkCache key), so the same cover isn't compared pixel by pixel
+    void SetArtwork(uint64_t key, const QImage &image);
+    void SetDefaultArtwork() { SetArtwork(DEFAULT_ARTWORK, QImage()); }
+    void SetStatsText(const QString &text);
+
+    // the fields changed since the last call, clearing them
+    unsigned TakeDirty();
+    // everything, for when the widgets have to be rebuilt from scratch
+    void MarkAllDirty() { dirty = SongText | Artwork | StatsText; }
+
+    const QString &GetSongText() const { return songText; }
+    uint64_t GetArtworkKey() const { return artworkKey; }
+    const QImage &GetArtwork() const { return artwork; }
+    const QString &GetStatsText() const { return statsText; }
+
+private:
+    QString songText;
+    uint64_t artworkKey = DEFAULT_ARTWORK;
+    QImage artwork;
+    QString statsText;
+    unsigned dirty = SongText | Artwork | StatsText;
+};
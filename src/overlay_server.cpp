@@ -0,0 +1,847 @@
+#include "overlay_server.h"
+#include "listen_socket.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "sha1.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const size_t MAX_CLIENTS = 1024;      // past this a new connection is closed straight away
+    const size_t MAX_REQUEST_BYTES = 8192;
+    const size_t MAX_FRAME_BYTES = 4096;  // an overlay has nothing to say beyond pings and close
+    const long long SEEK_TOLERANCE_MS = 2000; // poll jitter, not a seek
+    const char *WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    const char *OVERLAY_PAGE = R"(<!doctype html>
+<meta charset="utf-8">
+<title>DiscordMusicBee</title>
+<style>
+body { margin: 0; font: 24px sans-serif; color: #fff; background: transparent; }
+#np { display: flex; align-items: center; gap: 16px; padding: 16px; }
+#np.off { visibility: hidden; }
+img { width: 96px; height: 96px; border-radius: 10px; }
+small { display: block; font-size: 18px; opacity: 0.8; }
+</style>
+<div id="np" class="off"><img id="cover" alt=""><div><span id="title"></span><small id="artist"></small></div></div>
+<script>
+function connect() {
+    const ws = new WebSocket((location.protocol === "https:" ? "wss://" : "ws://") + location.host + "/ws");
+    ws.onmessage = (event) => {
+        const np = JSON.parse(event.data);
+        document.getElementById("np").className = np.playing ? "" : "off";
+        document.getElementById("title").textContent = np.title;
+        document.getElementById("artist").textContent = np.artist;
+        const cover = document.getElementById("cover");
+        cover.hidden = !np.artwork;
+        if (np.artwork)
+            cover.src = np.artwork;
+    };
+    ws.onclose = () => setTimeout(connect, 2000);
+}
+connect();
+</script>
+)";
+
+    typedef std::shared_ptr<const std::string> Buffer;
+
+    // part of a shared buffer still to be sent. a state frame that hasn't started going out is
+    // replaced by a newer one, so a slow overlay falls one state behind rather than queueing them
+    struct Pending
+    {
+        Buffer data;
+        size_t offset;
+        bool state;
+    };
+
+    struct Client
+    {
+        Socket socket;
+        std::string input; // the request, then websocket frames
+        std::deque<Pending> output;
+        std::string allowedOrigin; // echoed as Access-Control-Allow-Origin, for a page on the allow list
+        bool webSocket = false;
+        bool closing = false; // close once output drains
+        bool dead = false;
+    };
+
+    // what the poll loop last published, under stateMutex
+    struct Published
+    {
+        Buffer json;
+        Buffer frame; // json as a websocket text frame, shared by every overlay it's pushed to
+        Buffer cover;
+        std::string coverPath; // /artwork/<hash>.<ext>
+        const char *coverType = "";
+        uint64_t version = 0;
+    };
+
+    std::atomic_bool enabled{false};
+    std::thread server;
+    Socket listener = NO_SOCKET;
+    std::string unixPath;
+    std::vector<std::string> allowedOrigins; // set before the loop starts, only read by it
+    std::string listenHost;                  // the address's host, lower case without brackets
+
+    std::mutex stateMutex;
+    Published published;
+    MusicInfo publishedMusic;
+    std::chrono::steady_clock::time_point publishedAt;
+    long long publishedAtMs = 0; // the same moment as unix time, for the json
+
+    // wakes the loop from the publishing thread and stopOverlay. windows only polls sockets, so
+    // there it's a udp socket connected to itself
+#ifdef _WIN32
+    Socket wakeSocket = NO_SOCKET;
+
+    bool openWake()
+    {
+        wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (wakeSocket == NO_SOCKET)
+            return false;
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int length = sizeof(local);
+        if (bind(wakeSocket, reinterpret_cast<sockaddr *>(&local), length) != 0 ||
+            getsockname(wakeSocket, reinterpret_cast<sockaddr *>(&local), &length) != 0 ||
+            connect(wakeSocket, reinterpret_cast<sockaddr *>(&local), length) != 0)
+        {
+            closeSocket(wakeSocket);
+            wakeSocket = NO_SOCKET;
+            return false;
+        }
+        setNonBlocking(wakeSocket, true);
+        return true;
+    }
+
+    void closeWake()
+    {
+        closeSocket(wakeSocket);
+        wakeSocket = NO_SOCKET;
+    }
+
+    Socket wakeHandle()
+    {
+        return wakeSocket;
+    }
+
+    void wake()
+    {
+        const char byte = 0;
+        send(wakeSocket, &byte, 1, 0);
+    }
+
+    void drainWake()
+    {
+        char buffer[64];
+        while (recv(wakeSocket, buffer, sizeof(buffer), 0) > 0)
+        {
+        }
+    }
+
+    int pollSockets(pollfd *watched, size_t count)
+    {
+        return WSAPoll(watched, static_cast<ULONG>(count), -1);
+    }
+#else
+    int wakePipe[2] = {-1, -1};
+
+    bool openWake()
+    {
+        if (pipe(wakePipe) != 0)
+            return false;
+        // a full pipe already means "wake up", so neither end ever has to block
+        fcntl(wakePipe[0], F_SETFL, fcntl(wakePipe[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(wakePipe[1], F_SETFL, fcntl(wakePipe[1], F_GETFL, 0) | O_NONBLOCK);
+        return true;
+    }
+
+    void closeWake()
+    {
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+        wakePipe[0] = wakePipe[1] = -1;
+    }
+
+    Socket wakeHandle()
+    {
+        return wakePipe[0];
+    }
+
+    void wake()
+    {
+        const char byte = 0;
+        if (write(wakePipe[1], &byte, 1) < 0 && errno != EAGAIN)
+            perror("overlay");
+    }
+
+    void drainWake()
+    {
+        char buffer[64];
+        while (read(wakePipe[0], buffer, sizeof(buffer)) > 0)
+        {
+        }
+    }
+
+    int pollSockets(pollfd *watched, size_t count)
+    {
+        return poll(watched, static_cast<nfds_t>(count), -1);
+    }
+#endif
+
+    long long unixNowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    std::string base64(const unsigned char *data, size_t length)
+    {
+        static const char DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        for (size_t i = 0; i < length; i += 3)
+        {
+            const uint32_t chunk = (uint32_t(data[i]) << 16) | (i + 1 < length ? uint32_t(data[i + 1]) << 8 : 0) |
+                                   (i + 2 < length ? data[i + 2] : 0);
+            out += DIGITS[(chunk >> 18) & 63];
+            out += DIGITS[(chunk >> 12) & 63];
+            out += i + 1 < length ? DIGITS[(chunk >> 6) & 63] : '=';
+            out += i + 2 < length ? DIGITS[chunk & 63] : '=';
+        }
+        return out;
+    }
+
+    std::string webSocketFrame(int opcode, const std::string &payload)
+    {
+        std::string frame;
+        frame += static_cast<char>(0x80 | opcode); // always a single, final frame
+        if (payload.size() < 126)
+        {
+            frame += static_cast<char>(payload.size());
+        }
+        else if (payload.size() <= 0xFFFF)
+        {
+            frame += static_cast<char>(126);
+            frame += static_cast<char>(payload.size() >> 8);
+            frame += static_cast<char>(payload.size() & 0xFF);
+        }
+        else
+        {
+            frame += static_cast<char>(127);
+            for (int shift = 56; shift >= 0; shift -= 8)
+                frame += static_cast<char>((static_cast<uint64_t>(payload.size()) >> shift) & 0xFF);
+        }
+        return frame + payload;
+    }
+
+    const char *imageType(const std::string &image, const char **extension)
+    {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(image.data());
+        if (image.size() >= 8 && memcmp(bytes, "\x89PNG\r\n\x1a\n", 8) == 0)
+        {
+            *extension = "png";
+            return "image/png";
+        }
+        if (image.size() >= 3 && bytes[0] == 0xFF && bytes[1] == 0xD8 && bytes[2] == 0xFF)
+        {
+            *extension = "jpg";
+            return "image/jpeg";
+        }
+        if (image.size() >= 6 && memcmp(bytes, "GIF8", 4) == 0)
+        {
+            *extension = "gif";
+            return "image/gif";
+        }
+        if (image.size() >= 12 && memcmp(bytes, "RIFF", 4) == 0 && memcmp(bytes + 8, "WEBP", 4) == 0)
+        {
+            *extension = "webp";
+            return "image/webp";
+        }
+        *extension = "bin";
+        return "application/octet-stream";
+    }
+
+    // rebuilds the json and its frame from publishedMusic and wakes the loop to push it; caller
+    // holds stateMutex
+    void publishState()
+    {
+        const MusicInfo &music = publishedMusic;
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("playing");
+        writer.Bool(music.isPlaying);
+        writer.Key("title");
+        writer.String(music.title.c_str(), static_cast<rapidjson::SizeType>(music.title.size()));
+        writer.Key("artist");
+        writer.String(music.artist.c_str(), static_cast<rapidjson::SizeType>(music.artist.size()));
+        writer.Key("album");
+        writer.String(music.album.c_str(), static_cast<rapidjson::SizeType>(music.album.size()));
+        writer.Key("position_ms");
+        writer.Int(music.positionMs);
+        writer.Key("duration_ms");
+        writer.Int(music.durationMs);
+        writer.Key("at");
+        writer.Int64(publishedAtMs);
+        writer.Key("artwork");
+        if (published.coverPath.empty())
+            writer.Null();
+        else
+            writer.String(published.coverPath.c_str(), static_cast<rapidjson::SizeType>(published.coverPath.size()));
+        writer.EndObject();
+
+        const std::string json(buffer.GetString(), buffer.GetSize());
+        published.json = std::make_shared<const std::string>(json);
+        published.frame = std::make_shared<const std::string>(webSocketFrame(0x1, json));
+        ++published.version;
+        if (enabled)
+            wake();
+    }
+
+    Published snapshot()
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        return published;
+    }
+
+    // the value of header name (lower case) in request, empty if it isn't there
+    std::string headerValue(const std::string &request, const char *name)
+    {
+        const size_t nameLength = strlen(name);
+        size_t line = request.find("\r\n");
+        while (line != std::string::npos && line + 2 < request.size())
+        {
+            line += 2;
+            const size_t end = request.find("\r\n", line);
+            const size_t colon = request.find(':', line);
+            if (colon != std::string::npos && colon < end && colon - line == nameLength)
+            {
+                bool same = true;
+                for (size_t i = 0; i < nameLength && same; ++i)
+                    same = tolower(static_cast<unsigned char>(request[line + i])) == name[i];
+                if (same)
+                {
+                    const size_t first = request.find_first_not_of(" \t", colon + 1);
+                    const size_t last = request.find_last_not_of(" \t", end - 1);
+                    return first <= last && first < end ? request.substr(first, last - first + 1) : std::string();
+                }
+            }
+            line = end;
+        }
+        return std::string();
+    }
+
+    std::string lowerCase(std::string text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c)
+                       { return static_cast<char>(tolower(c)); });
+        return text;
+    }
+
+    // what a browser put in Host is the name it resolved to get here. localhost, an ip address or
+    // the host we were told to listen on are fine; any other name means some site pointed its own
+    // name at this machine (dns rebinding), and its page's requests carry no Origin at all, being
+    // same-origin as far as the browser knows. none on a unix socket, which no browser reaches
+    bool hostAllowed(const std::string &request)
+    {
+        const std::string host = lowerCase(headerValue(request, "host"));
+        if (host.empty() || !unixPath.empty())
+            return true;
+        if (host[0] == '[')
+            return true;
+        const std::string name = host.substr(0, host.rfind(':'));
+        return name == "localhost" || name == listenHost || name.find_first_not_of("0123456789.") == std::string::npos;
+    }
+
+    // OBS sends no Origin, or "null" from a local file; any other browser page has to be ours (Host
+    // is checked already) or on the allow list, or it could read what's playing from anywhere
+    bool originAllowed(Client &client, const std::string &request)
+    {
+        const std::string origin = headerValue(request, "origin");
+        if (origin.empty() || origin == "null" || origin == "http://" + headerValue(request, "host"))
+            return true;
+        if (std::find(allowedOrigins.begin(), allowedOrigins.end(), origin) == allowedOrigins.end())
+            return false;
+        client.allowedOrigin = origin;
+        return true;
+    }
+
+    void enqueue(Client &client, Buffer data, bool state)
+    {
+        if (state && !client.output.empty())
+        {
+            Pending &last = client.output.back();
+            if (last.state && last.offset == 0)
+            {
+                last.data = std::move(data);
+                return;
+            }
+        }
+        client.output.push_back({std::move(data), 0, state});
+    }
+
+    // body null for none at all (a 304); head leaves it out but still gives its length
+    void respond(Client &client, const char *status, const char *type, const std::string &headers, const Buffer &body, bool head)
+    {
+        char start[256];
+        snprintf(start, sizeof(start), "HTTP/1.1 %s\r\nContent-Type: %s\r\nConnection: close\r\n", status, type);
+        std::string response = start + headers;
+        if (!client.allowedOrigin.empty())
+            response += "Access-Control-Allow-Origin: " + client.allowedOrigin + "\r\nVary: Origin\r\n";
+        if (body)
+            response += "Content-Length: " + std::to_string(body->size()) + "\r\n";
+        enqueue(client, std::make_shared<const std::string>(response + "\r\n"), false);
+        if (body && !head && !body->empty())
+            enqueue(client, body, false);
+        client.closing = true;
+    }
+
+    void answer(Client &client, const std::string &request)
+    {
+        const size_t methodEnd = request.find(' ');
+        const size_t pathEnd = methodEnd == std::string::npos ? std::string::npos : request.find(' ', methodEnd + 1);
+        if (pathEnd == std::string::npos)
+        {
+            client.dead = true;
+            return;
+        }
+        const std::string method = request.substr(0, methodEnd);
+        std::string path = request.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+        path = path.substr(0, path.find('?'));
+        const bool head = method == "HEAD";
+
+        static const Buffer NOT_FOUND = std::make_shared<const std::string>("not found\n");
+        if (!hostAllowed(request))
+        {
+            respond(client, "403 Forbidden", "text/plain", "", std::make_shared<const std::string>("host not allowed\n"), head);
+            return;
+        }
+        if (!originAllowed(client, request))
+        {
+            respond(client, "403 Forbidden", "text/plain", "", std::make_shared<const std::string>("origin not allowed\n"), head);
+            return;
+        }
+        if (method != "GET" && !head)
+        {
+            respond(client, "405 Method Not Allowed", "text/plain", "Allow: GET, HEAD\r\n", NOT_FOUND, head);
+            return;
+        }
+
+        if (path == "/ws")
+        {
+            const std::string key = headerValue(request, "sec-websocket-key");
+            std::string upgrade = headerValue(request, "upgrade");
+            std::transform(upgrade.begin(), upgrade.end(), upgrade.begin(), [](unsigned char c)
+                           { return static_cast<char>(tolower(c)); });
+            if (key.empty() || upgrade != "websocket")
+            {
+                respond(client, "400 Bad Request", "text/plain", "", std::make_shared<const std::string>("websocket only\n"), head);
+                return;
+            }
+
+            unsigned char digest[20];
+            const std::string accept = key + WEBSOCKET_GUID;
+            Sha1(accept.data(), accept.size(), digest);
+            enqueue(client, std::make_shared<const std::string>("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: " + base64(digest, sizeof(digest)) + "\r\n\r\n"), false);
+            client.webSocket = true;
+            enqueue(client, snapshot().frame, true);
+            return;
+        }
+
+        if (path == "/now-playing")
+        {
+            respond(client, "200 OK", "application/json", "Cache-Control: no-store\r\n", snapshot().json, head);
+            return;
+        }
+
+        if (path == "/")
+        {
+            static const Buffer PAGE = std::make_shared<const std::string>(OVERLAY_PAGE);
+            respond(client, "200 OK", "text/html; charset=utf-8", "Cache-Control: no-cache\r\n", PAGE, head);
+            return;
+        }
+
+        // only the current cover; an overlay still asking for the last one has its own copy cached
+        const Published state = snapshot();
+        if (!state.coverPath.empty() && path == state.coverPath)
+        {
+            const std::string etag = "\"" + state.coverPath.substr(9, 16) + "\"";
+            const std::string headers = "ETag: " + etag + "\r\nCache-Control: public, max-age=31536000, immutable\r\n";
+            if (headerValue(request, "if-none-match").find(etag) != std::string::npos)
+                respond(client, "304 Not Modified", state.coverType, headers, nullptr, true);
+            else
+                respond(client, "200 OK", state.coverType, headers, state.cover, head);
+            return;
+        }
+
+        respond(client, "404 Not Found", "text/plain", "", NOT_FOUND, head);
+    }
+
+    void readFrames(Client &client)
+    {
+        while (client.input.size() >= 2)
+        {
+            const unsigned char *bytes = reinterpret_cast<const unsigned char *>(client.input.data());
+            const int opcode = bytes[0] & 0x0F;
+            size_t length = bytes[1] & 0x7F;
+            size_t header = 2;
+            if (length == 126)
+            {
+                if (client.input.size() < 4)
+                    return;
+                length = (size_t(bytes[2]) << 8) | bytes[3];
+                header = 4;
+            }
+            // browsers always mask (RFC 6455 5.1), and nothing an overlay sends is long
+            if (!(bytes[1] & 0x80) || length == 127 || length > MAX_FRAME_BYTES)
+            {
+                client.dead = true;
+                return;
+            }
+            if (client.input.size() < header + 4 + length)
+                return;
+
+            std::string payload = client.input.substr(header + 4, length);
+            for (size_t i = 0; i < length; ++i)
+                payload[i] = static_cast<char>(payload[i] ^ bytes[header + i % 4]);
+            client.input.erase(0, header + 4 + length);
+
+            if (opcode == 0x8)
+            {
+                // echo the status code back and hang up once it's out
+                enqueue(client, std::make_shared<const std::string>(webSocketFrame(0x8, payload.substr(0, 2))), false);
+                client.closing = true;
+                client.input.clear();
+                return;
+            }
+            if (opcode == 0x9)
+                enqueue(client, std::make_shared<const std::string>(webSocketFrame(0xA, payload)), false);
+            // text, binary and pongs are ignored
+        }
+    }
+
+    void readClient(Client &client)
+    {
+        char buffer[4096];
+        const int received = recv(client.socket, buffer, sizeof(buffer), 0);
+        if (received == 0 || (received < 0 && !wouldBlock()))
+        {
+            client.dead = true;
+            return;
+        }
+        if (received < 0 || client.closing)
+            return; // anything after a request or a close is ignored
+        client.input.append(buffer, received);
+
+        if (client.webSocket)
+        {
+            readFrames(client);
+            return;
+        }
+
+        const size_t headerEnd = client.input.find("\r\n\r\n");
+        if (headerEnd == std::string::npos)
+        {
+            if (client.input.size() > MAX_REQUEST_BYTES)
+                client.dead = true;
+            return;
+        }
+        const std::string request = client.input.substr(0, headerEnd + 2);
+        client.input.erase(0, headerEnd + 4);
+        answer(client, request);
+        if (client.webSocket && !client.input.empty())
+            readFrames(client);
+    }
+
+    void flush(Client &client)
+    {
+        while (!client.output.empty())
+        {
+            Pending &next = client.output.front();
+            const size_t left = std::min(next.data->size() - next.offset, static_cast<size_t>(INT_MAX));
+            const int sent = send(client.socket, next.data->data() + next.offset, static_cast<int>(left), SEND_FLAGS);
+            if (sent <= 0)
+            {
+                if (sent < 0 && !wouldBlock())
+                    client.dead = true;
+                return;
+            }
+            next.offset += static_cast<size_t>(sent);
+            if (next.offset == next.data->size())
+                client.output.pop_front();
+        }
+        if (client.closing)
+            client.dead = true;
+    }
+
+    void acceptClients(std::vector<Client> &clients)
+    {
+        for (;;)
+        {
+            const Socket socket = accept(listener, nullptr, nullptr);
+            if (socket == NO_SOCKET)
+                return;
+            if (clients.size() >= MAX_CLIENTS)
+            {
+                closeSocket(socket);
+                continue;
+            }
+            setNonBlocking(socket, true); // inherited from the listener on windows, not on linux
+            Client client;
+            client.socket = socket;
+            clients.push_back(std::move(client));
+        }
+    }
+
+    void serve()
+    {
+        std::vector<Client> clients;
+        std::vector<pollfd> watched;
+        uint64_t deliveredVersion = 0;
+
+        while (enabled)
+        {
+            watched.clear();
+            watched.push_back({wakeHandle(), POLLIN, 0});
+            watched.push_back({listener, POLLIN, 0});
+            for (const Client &client : clients)
+                watched.push_back({client.socket, static_cast<short>(client.output.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+            if (pollSockets(watched.data(), watched.size()) < 0)
+                continue; // EINTR
+
+            if (watched[0].revents)
+            {
+                drainWake();
+                const Published state = snapshot();
+                if (state.version != deliveredVersion)
+                {
+                    for (Client &client : clients)
+                    {
+                        if (client.webSocket && !client.closing)
+                            enqueue(client, state.frame, true);
+                    }
+                    deliveredVersion = state.version;
+                }
+            }
+
+            // accepted ones are polled from the next round on
+            const size_t polled = clients.size();
+            if (watched[1].revents & POLLIN)
+                acceptClients(clients);
+
+            for (size_t i = 0; i < polled; ++i)
+            {
+                Client &client = clients[i];
+                const short revents = watched[i + 2].revents;
+                if (revents & (POLLERR | POLLNVAL))
+                    client.dead = true;
+                else if (revents & (POLLIN | POLLHUP))
+                    readClient(client);
+                if (!client.dead && !client.output.empty())
+                    flush(client);
+            }
+
+            clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client &client)
+                                         {
+                if (client.dead)
+                    closeSocket(client.socket);
+                return client.dead; }),
+                          clients.end());
+        }
+
+        for (const Client &client : clients)
+            closeSocket(client.socket);
+    }
+}
+
+bool startOverlay(const std::string &address, const std::vector<std::string> &origins)
+{
+    if (enabled || address.empty())
+        return false;
+    allowedOrigins = origins;
+    // as listenOn splits it; just a port is 127.0.0.1, an ip address anyway
+    const size_t colon = address.rfind(':');
+    listenHost = colon == std::string::npos ? std::string() : lowerCase(address.substr(0, colon));
+    if (listenHost.size() >= 2 && listenHost.front() == '[' && listenHost.back() == ']')
+        listenHost = listenHost.substr(1, listenHost.size() - 2);
+
+    if (!startSockets())
+        return false;
+    listener = listenOn(address, &unixPath);
+    if (listener == NO_SOCKET || !openWake())
+    {
+        if (listener != NO_SOCKET)
+            closeSocket(listener);
+        listener = NO_SOCKET;
+        stopSockets();
+        return false;
+    }
+    // accept never blocks, readiness comes from poll
+    setNonBlocking(listener, true);
+
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        publishState(); // nothing playing until the first poll says otherwise
+    }
+    enabled = true;
+
+#ifdef _WIN32
+    server = std::thread(serve);
+#else
+    // the thread inherits this mask, so ctrl-c and friends keep going to whoever waits for them
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    server = std::thread(serve);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+#endif
+    return true;
+}
+
+bool startOverlayFromArgs(int argc, char *argv[])
+{
+    const char *address = std::getenv("DMB_OVERLAY");
+    std::vector<std::string> origins;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], "--overlay") == 0)
+            address = argv[i + 1];
+        else if (strcmp(argv[i], "--overlay-origin") == 0)
+            origins.push_back(argv[i + 1]);
+    }
+
+    // the flags replace the variable's list rather than adding to it
+    const char *originList = std::getenv("DMB_OVERLAY_ORIGINS");
+    if (origins.empty() && originList)
+    {
+        const std::string list = originList;
+        for (size_t start = 0; start <= list.size();)
+        {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos)
+                end = list.size();
+            const size_t first = list.find_first_not_of(' ', start);
+            const size_t last = list.find_last_not_of(' ', end - 1);
+            if (first < end && last != std::string::npos && last >= first)
+                origins.push_back(list.substr(first, last - first + 1));
+            start = end + 1;
+        }
+    }
+    return address ? startOverlay(address, origins) : true;
+}
+
+void stopOverlay()
+{
+    if (!enabled)
+        return;
+    enabled = false;
+    wake();
+    server.join();
+
+    closeSocket(listener);
+    listener = NO_SOCKET;
+    closeWake();
+#ifndef _WIN32
+    if (!unixPath.empty())
+        unlink(unixPath.c_str());
+#endif
+    unixPath.clear();
+    stopSockets();
+}
+
+bool overlayEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+int overlayPort()
+{
+    if (!enabled || !unixPath.empty())
+        return 0;
+    sockaddr_storage local;
+    socklen_t length = sizeof(local);
+    if (getsockname(listener, reinterpret_cast<sockaddr *>(&local), &length) != 0)
+        return 0;
+    if (local.ss_family == AF_INET6)
+        return ntohs(reinterpret_cast<const sockaddr_in6 &>(local).sin6_port);
+    return ntohs(reinterpret_cast<const sockaddr_in &>(local).sin_port);
+}
+
+void publishNowPlaying(const MusicInfo &music)
+{
+    if (!overlayEnabled())
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(stateMutex);
+    const bool changed = music.isPlaying != publishedMusic.isPlaying || music.durationMs != publishedMusic.durationMs ||
+                         music.title != publishedMusic.title || music.artist != publishedMusic.artist ||
+                         music.album != publishedMusic.album;
+    bool seeked = false;
+    if (music.positionMs >= 0 && publishedMusic.positionMs >= 0)
+    {
+        long long expectedMs = publishedMusic.positionMs;
+        if (publishedMusic.isPlaying)
+            expectedMs += std::chrono::duration_cast<std::chrono::milliseconds>(now - publishedAt).count();
+        seeked = std::llabs(music.positionMs - expectedMs) > SEEK_TOLERANCE_MS;
+    }
+    if (!changed && !seeked)
+        return;
+
+    publishedMusic = music;
+    publishedAt = now;
+    publishedAtMs = unixNowMs();
+    publishState();
+}
+
+void publishArtwork(std::shared_ptr<const std::string> image, uint64_t hash)
+{
+    if (!overlayEnabled())
+        return;
+
+    std::string path;
+    const char *type = "";
+    if (image && !image->empty())
+    {
+        const char *extension;
+        type = imageType(*image, &extension);
+        char name[48];
+        snprintf(name, sizeof(name), "/artwork/%016llx.%s", static_cast<unsigned long long>(hash), extension);
+        path = name;
+    }
+    else
+    {
+        image.reset();
+    }
+
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (path == published.coverPath)
+        return;
+    published.cover = std::move(image);
+    published.coverPath = std::move(path);
+    published.coverType = type;
+    publishState();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "presence_bridge.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Now playing for stream overlays (an OBS browser source and the like), served when
+// --overlay <address> or DMB_OVERLAY=<address> is given; addresses as for --metrics. One thread
+// runs an event loop over every connection, so a few hundred overlays cost a longer poll() set,
+// not threads.
+//
+//   GET /                      a plain overlay page built on the two below
+//   GET /now-playing           the current state as JSON
+//   GET /ws                    a WebSocket sent that JSON on connecting and whenever it changes
+//   GET /artwork/<hash>.<ext>  the current cover, named by a hash of its bytes, so it's served
+//                              with an ETag and as immutable
+//
+// {"playing","title","artist","album","position_ms","duration_ms","at","artwork"}: at is the unix
+// time position_ms was read, so an overlay runs its own progress bar; the position moving along
+// isn't a change, a seek is.
+//
+// A request is refused (403) if its Host names anything but localhost, an ip address or the host
+// in address, which is what a page behind dns rebinding sends. One with an Origin header is
+// refused too unless it's "null", the page at / itself, or one of origins (exact
+// "scheme://host[:port]" strings), which get it back as Access-Control-Allow-Origin. OBS sends no
+// Origin at all.
+
+// false if the address doesn't parse or can't be listened on
+bool startOverlay(const std::string &address, const std::vector<std::string> &origins = {});
+
+// startOverlay on DMB_OVERLAY or "--overlay <address>" (the flag wins), with the origins from each
+// "--overlay-origin <origin>" or else the comma separated DMB_OVERLAY_ORIGINS; true if no address
+// is given
+bool startOverlayFromArgs(int argc, char *argv[]);
+
+void stopOverlay();
+
+bool overlayEnabled();
+
+// the tcp port listened on, for an address ending in ":0"; 0 when stopped or on a unix socket
+int overlayPort();
+
+// every poll tick (OverlaySink); nothing goes out unless something an overlay shows changed
+void publishNowPlaying(const MusicInfo &music);
+
+// the cover as an image file's bytes (png, jpeg, ...), sent straight from this buffer to every
+// connection asking for it; null when there's none. hash is Xxh64 of the bytes, for its url
+void publishArtwork(std::shared_ptr<const std::string> image, uint64_t hash);
@@ -0,0 +1,47 @@
+#include "poll_scheduler.h"
+#include <algorithm>
+
+int PollScheduler::NextIntervalMs(State state, int positionMs, int durationMs)
+{
+    ++stats.ticks;
+    ++stats.ticksByState[static_cast<int>(state)];
+
+    if (state != State::Absent)
+        absentDelayMs = 0;
+
+    switch (state)
+    {
+    case State::Playing:
+    {
+        if (durationMs <= 0 || positionMs < 0)
+            return PLAYING_MS;
+
+        const int remainingMs = durationMs - positionMs;
+        if (remainingMs <= NEAR_END_MS)
+            return FAST_MS;
+
+        // land the next poll just before the end window rather than overshooting into the next track
+        return std::clamp(remainingMs - NEAR_END_MS, FAST_MS, PLAYING_MS);
+    }
+    case State::Paused:
+        return PAUSED_MS;
+    case State::Stopped:
+        return STOPPED_MS;
+    case State::Absent:
+    default:
+        absentDelayMs = absentDelayMs ? std::min(absentDelayMs * 2, ABSENT_MAX_MS) : ABSENT_MIN_MS;
+        return absentDelayMs;
+    }
+}
+
+PollScheduler::Stats PollScheduler::TakeStats(std::chrono::steady_clock::duration *elapsed)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (elapsed)
+        *elapsed = now - statsSince;
+
+    Stats taken = stats;
+    stats = Stats();
+    statsSince = now;
+    return taken;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Picks how long to wait before the next MusicBee poll from what the last one saw, instead of a
+// fixed 500 ms: quick around the predicted end of a track so the next one shows up promptly,
+// relaxed mid-track, slow while paused or stopped, and backing off exponentially while MusicBee
+// isn't running at all.
+class PollScheduler
+{
+public:
+    enum class State : int
+    {
+        Playing,
+        Paused,
+        Stopped,
+        Absent,
+        Count
+    };
+
+    struct Stats
+    {
+        uint64_t ticks = 0;
+        uint64_t ticksByState[static_cast<int>(State::Count)] = {};
+    };
+
+    static constexpr int FAST_MS = 250;         // around a track change
+    static constexpr int PLAYING_MS = 1000;     // mid-track; still catches skips and pauses quickly
+    static constexpr int NEAR_END_MS = 1500;    // remaining time under which we go fast
+    static constexpr int PAUSED_MS = 2000;
+    static constexpr int STOPPED_MS = 3000;
+    static constexpr int ABSENT_MIN_MS = 1000;
+    static constexpr int ABSENT_MAX_MS = 60 * 1000;
+
+    // positionMs/durationMs only matter while playing; durationMs <= 0 means unknown (streams)
+    int NextIntervalMs(State state, int positionMs, int durationMs);
+
+    // ticks since the last TakeStats, and how long that covered
+    Stats TakeStats(std::chrono::steady_clock::duration *elapsed);
+
+private:
+    int absentDelayMs = 0;
+    Stats stats;
+    std::chrono::steady_clock::time_point statsSince = std::chrono::steady_clock::now();
+};
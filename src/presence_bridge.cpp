@@ -0,0 +1,345 @@
+#include "presence_bridge.h"
+#include "overlay_server.h"
+#include "presence_sinks.h"
+#include "startup_trace.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <signal.h>
+#include <thread>
+#endif
+
+const std::string DISCORD_APP_ID = std::getenv("DISCORD_APP_ID") ? std::getenv("DISCORD_APP_ID") : "";
+const char *DISCORD_DETAILS = "";
+const char *DISCORD_STATE = "";
+const char *DISCORD_LARGE_IMAGE_KEY = "something";       // https://discord.com/developers/applications/DISCORD_APP_ID/rich-presence/assets/something.png
+const char *DISCORD_LARGE_IMAGE_TEXT = "something-else"; // https://discord.com/developers/applications/DISCORD_APP_ID/rich-presence/assets/something-else.png
+
+namespace
+{
+    const int DISCORD_HEARTBEAT_MS = 15000; // ping discord ourselves so a dead pipe is noticed before the next write
+    const int DISCORD_HEARTBEAT_MAX_MISSED = 3;
+    const auto POLL_STATS_INTERVAL = std::chrono::hours(1);
+
+    std::mutex stopMutex;
+    std::condition_variable stopSignal;
+    std::atomic_bool stopRequested{false};
+
+    void requestStop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(stopMutex);
+            stopRequested = true;
+        }
+        stopSignal.notify_all();
+    }
+
+#ifdef _WIN32
+    BOOL WINAPI onConsoleControl(DWORD)
+    {
+        // runs on its own thread; returning lets the process die, so only wake the loop
+        requestStop();
+        return TRUE;
+    }
+
+    void watchForStop()
+    {
+        SetConsoleCtrlHandler(onConsoleControl, TRUE);
+    }
+#else
+    // a signal handler can't touch the mutex, so the signals are blocked everywhere (threads
+    // started later inherit that) and a thread of our own waits for them instead
+    std::thread stopWatcher;
+
+    void watchForStop()
+    {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        stopWatcher = std::thread([signals]()
+                                  {
+            int signal = 0;
+            sigwait(&signals, &signal);
+            requestStop(); });
+    }
+#endif
+}
+
+bool sameTrack(const MusicInfo &a, const MusicInfo &b)
+{
+    if (a.fileUrl != b.fileUrl)
+        return false;
+    return !a.fileUrl.empty() || (a.artist == b.artist && a.title == b.title);
+}
+
+bool PresenceTally::Key::operator==(const Key &other) const
+{
+    return std::equal(std::begin(fields), std::end(fields), std::begin(other.fields)) &&
+           startTimestamp == other.startTimestamp && endTimestamp == other.endTimestamp;
+}
+
+// every field fillPresence can set; a null one and an empty one are the same to Discord
+PresenceTally::Key PresenceTally::KeyOf(const DiscordRichPresence &presence)
+{
+    const auto tag = [](const char *field)
+    { return field ? Tag(field) : Tag(); };
+
+    Key key;
+    key.fields[0] = tag(presence.state);
+    key.fields[1] = tag(presence.details);
+    key.fields[2] = tag(presence.largeImageKey);
+    key.fields[3] = tag(presence.largeImageText);
+    key.fields[4] = tag(presence.smallImageKey);
+    key.fields[5] = tag(presence.smallImageText);
+    key.startTimestamp = presence.startTimestamp;
+    key.endTimestamp = presence.endTimestamp;
+    return key;
+}
+
+PresenceOutcome PresenceTally::Record(const DiscordRichPresence &presence, std::chrono::steady_clock::time_point now)
+{
+    const Key key = KeyOf(presence);
+    PresenceOutcome outcome = PresenceOutcome::Sent;
+    if (sentAny && key == sentKey)
+        outcome = PresenceOutcome::Repeated;
+    else if (sentAny && recentSends[nextSend] != std::chrono::steady_clock::time_point() &&
+             now - recentSends[nextSend] < RATE_LIMIT_WINDOW)
+        outcome = PresenceOutcome::OverLimit;
+    countPresence(outcome);
+
+    // the window is over what Discord got, repeats included
+    sentKey = key;
+    sentAny = true;
+    recentSends[nextSend] = now;
+    nextSend = (nextSend + 1) % RATE_LIMIT_UPDATES;
+    return outcome;
+}
+
+void PlayTracker::Observe(const MusicInfo &music, std::chrono::steady_clock::time_point now)
+{
+    if (!music.musicBeeRunning || music.playState == MBPlayState::Stopped)
+    {
+        Finish();
+        return;
+    }
+    if (!music.isPlaying)
+    {
+        // paused or loading; when exactly it stopped between ticks isn't known, so none of it counts
+        wasPlaying = false;
+        return;
+    }
+
+    // a new track, or the same one started over (repeat one, or skipping back to it)
+    const bool restarted = music.positionMs >= 0 && music.positionMs < 3000 && lastPositionMs > 10000;
+    if (!open || !sameTrack(music, currentTrack) || restarted)
+    {
+        Finish();
+        open = true;
+        currentTrack = music;
+        current.startedAtMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count();
+        current.listenedMs = 0;
+        current.durationMs = -1;
+        current.artist = music.artist;
+        current.album = music.album;
+        current.title = music.title;
+    }
+
+    if (wasPlaying)
+        current.listenedMs += static_cast<int32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - lastTick).count());
+    if (music.durationMs > 0)
+        current.durationMs = music.durationMs;
+    lastPositionMs = music.positionMs;
+    lastTick = now;
+    wasPlaying = true;
+}
+
+void PlayTracker::Finish()
+{
+    if (open && current.listenedMs >= MIN_LISTENED_MS)
+        history.Append(current);
+    open = false;
+    lastPositionMs = -1;
+    wasPlaying = false;
+}
+
+void setupDiscord()
+{
+    DiscordEventHandlers handlers;
+    memset(&handlers, 0, sizeof(handlers));
+    Discord_Initialize(DISCORD_APP_ID.c_str(), &handlers, 1, NULL);
+    Discord_SetHeartbeat(DISCORD_HEARTBEAT_MS, DISCORD_HEARTBEAT_MAX_MISSED);
+
+    // Initial presence update will happen on the first poll
+}
+
+MusicInfo getMusicBeeInfo(MusicBeeIPC &ipc)
+{
+    TraceSpan span("musicbee.read");
+    MusicInfo info;
+
+    if (!ipc.IsConnected())
+    {
+        if (!ipc.Connect())
+        {
+            return info;
+        }
+    }
+
+    // play state
+    info.musicBeeRunning = true;
+    info.playState = ipc.GetPlayState();
+    info.isPlaying = (info.playState == MBPlayState::Playing);
+
+    if (info.isPlaying)
+    {
+        // track metadata, each decoded onto the stack and interned: a tag seen before is a lookup
+        InlineString<MusicInfo::TAG_BYTES> tag;
+        ipc.GetFileTag(MBMetaDataType::TrackTitle, tag);
+        info.title = Tag(tag);
+        ipc.GetFileTag(MBMetaDataType::Artist, tag);
+        info.artist = Tag(tag);
+        ipc.GetFileTag(MBMetaDataType::Album, tag);
+        info.album = Tag(tag);
+        InlineString<MusicInfo::FILE_URL_BYTES> url;
+        ipc.GetFileUrl(url);
+        info.fileUrl = Tag(url);
+        info.positionMs = ipc.GetPosition();
+        info.durationMs = ipc.GetDuration();
+    }
+
+    return info;
+}
+
+void fillPresence(const MusicInfo &music, PresenceText &text, DiscordRichPresence &presence)
+{
+    TraceSpan span("presence.build");
+    memset(&presence, 0, sizeof(presence));
+
+    if (music.isPlaying && !music.title.empty())
+    {
+        text.details = "♪ ";
+        text.details.append(music.title);
+        text.state = "by ";
+        text.state.append(music.artist);
+        presence.details = text.details.c_str();
+        presence.state = text.state.c_str();
+        presence.largeImageKey = "music";
+        presence.largeImageText = "Listening to music";
+    }
+    else
+    {
+        presence.details = DISCORD_DETAILS;
+        presence.state = DISCORD_STATE;
+        presence.largeImageKey = DISCORD_LARGE_IMAGE_KEY;
+        presence.largeImageText = DISCORD_LARGE_IMAGE_TEXT;
+    }
+}
+
+PollScheduler::State pollState(const MusicInfo &music)
+{
+    if (!music.musicBeeRunning)
+        return PollScheduler::State::Absent;
+    if (music.playState == MBPlayState::Playing || music.playState == MBPlayState::Loading)
+        return PollScheduler::State::Playing;
+    if (music.playState == MBPlayState::Paused)
+        return PollScheduler::State::Paused;
+    return PollScheduler::State::Stopped;
+}
+
+std::string describePollStats(const PollScheduler::Stats &stats, std::chrono::steady_clock::duration elapsed)
+{
+    const double hours = std::chrono::duration<double, std::ratio<3600>>(elapsed).count();
+    const auto count = [&stats](PollScheduler::State state)
+    { return static_cast<unsigned long long>(stats.ticksByState[static_cast<int>(state)]); };
+
+    char line[256];
+    snprintf(line, sizeof(line),
+             "poll: %llu ticks (%.0f wakeups/h, fixed 500 ms would be 7200/h) - playing %llu, paused %llu, stopped %llu, musicbee absent %llu",
+             static_cast<unsigned long long>(stats.ticks), hours > 0 ? stats.ticks / hours : 0.0,
+             count(PollScheduler::State::Playing), count(PollScheduler::State::Paused),
+             count(PollScheduler::State::Stopped), count(PollScheduler::State::Absent));
+    return line;
+}
+
+int runHeadless(const std::string &historyPath, const std::string &nowPlayingFile)
+{
+    traceThreadName("poll");
+    watchForStop();
+    setupDiscord();
+    markStartup("discord");
+
+    HistoryLog history;
+    if (!historyPath.empty() && !history.Open(historyPath))
+        fprintf(stderr, "history: couldn't open %s\n", historyPath.c_str());
+    PresencePipeline pipeline;
+    addBridgeSinks(pipeline, history, nowPlayingFile);
+
+    MusicBeeIPC ipc;
+    PollScheduler scheduler;
+    bool loggedStartup = false;
+    auto statsSince = std::chrono::steady_clock::now();
+
+    while (!stopRequested)
+    {
+        std::shared_ptr<const NowPlaying> now;
+        {
+            TraceSpan span("poll");
+            now = pipeline.Publish(getMusicBeeInfo(ipc), ipc);
+            Discord_RunCallbacks();
+        }
+        const MusicInfo &music = now->music;
+
+        if (!loggedStartup)
+        {
+            markStartup("first presence");
+            printf("%s\n", describeStartup().c_str());
+            loggedStartup = true;
+        }
+
+        if (std::chrono::steady_clock::now() - statsSince >= POLL_STATS_INTERVAL)
+        {
+            std::chrono::steady_clock::duration elapsed;
+            PollScheduler::Stats stats = scheduler.TakeStats(&elapsed);
+            printf("%s\n", describePollStats(stats, elapsed).c_str());
+            statsSince = std::chrono::steady_clock::now();
+        }
+        fflush(stdout);
+
+        const PollScheduler::State state = pollState(music);
+        countPollTick(state);
+        const int delayMs = scheduler.NextIntervalMs(state, music.positionMs, music.durationMs);
+        std::unique_lock<std::mutex> lock(stopMutex);
+        stopSignal.wait_for(lock, std::chrono::milliseconds(delayMs), []()
+                            { return stopRequested.load(); });
+    }
+
+    pipeline.Stop(); // the last play is written, and nothing's sent to Discord after this
+    history.Close();
+    Discord_ClearPresence();
+    Discord_Shutdown();
+#ifndef _WIN32
+    stopWatcher.join();
+#endif
+    stopOverlay();
+    stopMetrics();
+    if (traceEnabled() && !writeTrace())
+        fprintf(stderr, "trace: couldn't write the trace file\n");
+    return 0;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include "discord_rpc.h"
+#include "history_log.h"
+#include "inline_string.h"
+#include "metrics.h"
+#include "musicbee_ipc.h"
+#include "poll_scheduler.h"
+#include "tag.h"
+
+// The MusicBee -> Discord loop with no Qt in it, shared by the window and the headless build.
+
+// app id from https://discord.com/developers/applications/
+extern const std::string DISCORD_APP_ID;
+extern const char *DISCORD_DETAILS;
+extern const char *DISCORD_STATE;
+extern const char *DISCORD_LARGE_IMAGE_KEY;
+extern const char *DISCORD_LARGE_IMAGE_TEXT;
+
+// Read every tick: each tag is decoded into a buffer on the stack and interned, so a snapshot is
+// built, copied and compared without the heap, and comparing tags is comparing ids. Longer tags
+// are cut; a file url past FILE_URL_BYTES only matters as a track's identity.
+struct MusicInfo
+{
+    static constexpr size_t TAG_BYTES = 256;
+    static constexpr size_t FILE_URL_BYTES = 1024;
+
+    Tag artist;
+    Tag title;
+    Tag album;
+    Tag fileUrl;
+    bool isPlaying = false;
+    bool musicBeeRunning = false;
+    MBPlayState playState = MBPlayState::Undefined;
+    int positionMs = -1;
+    int durationMs = -1;
+};
+
+// the same file, or for streams (no file url) the same artist and title
+bool sameTrack(const MusicInfo &a, const MusicInfo &b);
+
+// owns the strings a DiscordRichPresence points at, they have to outlive Discord_UpdatePresence.
+// Discord takes at most 128 bytes of each
+struct PresenceText
+{
+    static constexpr size_t FIELD_BYTES = 128;
+
+    InlineString<FIELD_BYTES> details;
+    InlineString<FIELD_BYTES> state;
+};
+
+// Counts the presences handed to Discord_UpdatePresence for the metrics endpoint, without holding
+// any back: one identical to the last is a repeat, and a changed one past Discord's limit of 5
+// updates per 20 s is over the limit. The last one is kept as interned fields, so that check is
+// comparing ids.
+class PresenceTally
+{
+public:
+    static constexpr int RATE_LIMIT_UPDATES = 5;
+    static constexpr std::chrono::seconds RATE_LIMIT_WINDOW{20};
+
+    // just before presence is sent
+    PresenceOutcome Record(const DiscordRichPresence &presence,
+                           std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+private:
+    struct Key
+    {
+        Tag fields[6];
+        int64_t startTimestamp = 0;
+        int64_t endTimestamp = 0;
+
+        bool operator==(const Key &other) const;
+    };
+
+    static Key KeyOf(const DiscordRichPresence &presence);
+
+    Key sentKey;
+    bool sentAny = false;
+    std::chrono::steady_clock::time_point recentSends[RATE_LIMIT_UPDATES] = {}; // ring, oldest at nextSend
+    int nextSend = 0;
+};
+
+// Turns the poll loop's snapshots into finished plays for the history log. Time counts while
+// MusicBee reports playing; pausing holds the play open, and it's written when another track
+// starts, playback stops, MusicBee goes away, or the tracker is destroyed.
+class PlayTracker
+{
+public:
+    static constexpr int MIN_LISTENED_MS = 5000; // anything shorter was skipped straight past
+
+    explicit PlayTracker(HistoryLog &history) : history(history) {}
+    ~PlayTracker() { Finish(); }
+
+    PlayTracker(const PlayTracker &) = delete;
+    PlayTracker &operator=(const PlayTracker &) = delete;
+
+    void Observe(const MusicInfo &music, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    void Finish();
+
+private:
+    HistoryLog &history;
+    Play current;
+    MusicInfo currentTrack; // what current was started from, for sameTrack
+    bool open = false;
+    int lastPositionMs = -1;
+    bool wasPlaying = false;
+    std::chrono::steady_clock::time_point lastTick;
+};
+
+void setupDiscord();
+MusicInfo getMusicBeeInfo(MusicBeeIPC &ipc);
+void fillPresence(const MusicInfo &music, PresenceText &text, DiscordRichPresence &presence);
+PollScheduler::State pollState(const MusicInfo &music);
+
+// one log line: ticks per state and wakeups per hour over the elapsed time
+std::string describePollStats(const PollScheduler::Stats &stats, std::chrono::steady_clock::duration elapsed);
+
+// polls until ctrl+c / close / logoff, no window and no event loop. plays are logged to
+// historyPath and now playing written to nowPlayingFile, unless they're empty
+int runHeadless(const std::string &historyPath, const std::string &nowPlayingFile);
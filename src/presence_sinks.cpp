@@ -0,0 +1,281 @@
+#include "presence_sinks.h"
+#include "overlay_server.h"
+#include "trace.h"
+#include "xxhash64.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+    // trace names, by SinkKind
+    const char *SINK_THREAD_NAMES[] = {"sink.discord", "sink.history", "sink.overlay", "sink.text_file"};
+    const char *SINK_SPAN_NAMES[] = {"sink.discord.consume", "sink.history.consume", "sink.overlay.consume",
+                                     "sink.text_file.consume"};
+
+    // what a snapshot counts as changed on; the position is left out
+    bool changed(const MusicInfo &before, const MusicInfo &music)
+    {
+        return music.musicBeeRunning != before.musicBeeRunning || music.isPlaying != before.isPlaying ||
+               music.playState != before.playState || music.durationMs != before.durationMs ||
+               music.title != before.title || music.artist != before.artist || music.album != before.album ||
+               music.fileUrl != before.fileUrl;
+    }
+}
+
+void PresencePipeline::Add(std::unique_ptr<PresenceSink> sink)
+{
+    wantsArtwork = wantsArtwork || sink->WantsArtwork();
+    workers.push_back(std::make_unique<Worker>());
+    Worker &worker = *workers.back();
+    worker.sink = std::move(sink);
+    worker.thread = std::thread(Run, std::ref(worker));
+}
+
+std::shared_ptr<const NowPlaying> PresencePipeline::Publish(MusicInfo music, MusicBeeIPC &ipc, bool fetchArtwork)
+{
+    // once per track: pausing and resuming, or a tag edit, keeps the cover already fetched. a
+    // missing one is asked for again every tick, MusicBee may still be downloading it
+    const bool artworkWanted = (wantsArtwork || fetchArtwork) && !music.title.empty();
+    if (artworkWanted && (!sameTrack(music, artworkTrack) || !artwork))
+    {
+        std::string image = MusicBeeIPC::DecodeArtwork(ipc.GetArtwork());
+        artworkHash = image.empty() ? 0 : Xxh64(image.data(), image.size());
+        artwork = image.empty() ? nullptr : std::make_shared<const std::string>(std::move(image));
+        artworkTrack = music;
+    }
+    // a cover that arrived late, or one only the window asked for, isn't in the last Derived yet
+    const bool artworkChanged = artworkWanted && last && last->derived->artwork != artwork;
+
+    const std::shared_ptr<NowPlaying> now = FreeSnapshot();
+    now->at = std::chrono::steady_clock::now();
+    now->changed = !last || changed(last->music, music) || artworkChanged;
+    if (now->changed)
+    {
+        auto derived = std::make_shared<NowPlaying::Derived>();
+        fillPresence(music, derived->text, derived->presence);
+        if (music.isPlaying && !music.title.empty())
+        {
+            if (!music.artist.empty())
+            {
+                derived->line.assign(music.artist);
+                derived->line += " - ";
+            }
+            derived->line += music.title;
+        }
+
+        if (artworkWanted)
+        {
+            derived->artwork = artwork;
+            derived->artworkHash = artworkHash;
+        }
+
+        now->derived = std::move(derived);
+    }
+    else
+    {
+        now->derived = last->derived;
+    }
+    now->music = music;
+
+    last = now;
+    for (const std::unique_ptr<Worker> &worker : workers)
+    {
+        if (last->changed || worker->sink->WantsEveryTick())
+            Push(*worker, last);
+    }
+    return last;
+}
+
+void PresencePipeline::Stop()
+{
+    for (const std::unique_ptr<Worker> &worker : workers)
+    {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->stopping = true;
+        }
+        worker->wake.notify_one();
+    }
+    for (const std::unique_ptr<Worker> &worker : workers)
+    {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+}
+
+std::shared_ptr<NowPlaying> PresencePipeline::FreeSnapshot()
+{
+    for (const std::shared_ptr<NowPlaying> &snapshot : snapshots)
+    {
+        if (snapshot.use_count() == 1)
+        {
+            // the last holder let go on another thread; see its reads before this one writes
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return snapshot;
+        }
+    }
+    // at most every queue full plus one in each sink's hands, so this stops growing
+    snapshots.push_back(std::make_shared<NowPlaying>());
+    return snapshots.back();
+}
+
+void PresencePipeline::Push(Worker &worker, const std::shared_ptr<const NowPlaying> &now)
+{
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        const auto slot = [&worker](size_t i) -> std::shared_ptr<const NowPlaying> &
+        { return worker.queue[(worker.head + i) % worker.queue.size()]; };
+
+        if (worker.queued == worker.queue.size())
+        {
+            size_t dropped = 0;
+            while (dropped < worker.queued && slot(dropped)->changed)
+                ++dropped;
+            if (dropped == worker.queued && worker.sink->WantsEveryTick())
+            {
+                // all changes, and losing one could lose a play: twice the room, laid out from 0
+                std::vector<std::shared_ptr<const NowPlaying>> grown(worker.queue.size() * 2);
+                for (size_t i = 0; i < worker.queued; ++i)
+                    grown[i] = std::move(slot(i));
+                worker.queue = std::move(grown);
+                worker.head = 0;
+            }
+            else
+            {
+                if (dropped == worker.queued)
+                    dropped = 0; // all changes, only the newest matters to this sink
+                for (size_t i = dropped; i + 1 < worker.queued; ++i)
+                    slot(i) = std::move(slot(i + 1));
+                slot(--worker.queued).reset();
+                countSinkDrop(worker.sink->Kind());
+            }
+        }
+        slot(worker.queued++) = now;
+    }
+    worker.wake.notify_one();
+}
+
+void PresencePipeline::Run(Worker &worker)
+{
+    const int kind = static_cast<int>(worker.sink->Kind());
+    traceThreadName(SINK_THREAD_NAMES[kind]);
+
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    for (;;)
+    {
+        // the sink's own state is only touched on this thread, the lock is for the queue
+        worker.wake.wait(lock, [&worker]()
+                         { return worker.queued || worker.stopping; });
+
+        if (worker.queued)
+        {
+            std::shared_ptr<const NowPlaying> next = std::move(worker.queue[worker.head]);
+            worker.head = (worker.head + 1) % worker.queue.size();
+            --worker.queued;
+            lock.unlock();
+            {
+                TraceSpan span(SINK_SPAN_NAMES[kind]);
+                worker.sink->Consume(next);
+            }
+            lock.lock();
+        }
+        else
+        {
+            break;
+        }
+    }
+    lock.unlock();
+    worker.sink->Finish();
+}
+
+void DiscordSink::Consume(const std::shared_ptr<const NowPlaying> &now)
+{
+    if (metricsEnabled())
+        tally.Record(now->derived->presence);
+    Discord_UpdatePresence(&now->derived->presence);
+}
+
+void HistorySink::Consume(const std::shared_ptr<const NowPlaying> &now)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    tracker.Observe(now->music, now->at);
+    plays.store(history.PlayCount(), std::memory_order_release);
+}
+
+void HistorySink::Finish()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    tracker.Finish();
+    plays.store(history.PlayCount(), std::memory_order_release);
+}
+
+void HistorySink::Read(const std::function<void(const HistoryLog &)> &fn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fn(history);
+}
+
+void OverlaySink::Consume(const std::shared_ptr<const NowPlaying> &now)
+{
+    if (now->changed)
+        publishArtwork(now->derived->artwork, now->derived->artworkHash);
+    publishNowPlaying(now->music);
+}
+
+void TextFileSink::Consume(const std::shared_ptr<const NowPlaying> &now)
+{
+    const std::filesystem::path target = std::filesystem::u8path(path);
+    std::filesystem::path temporary = target;
+    temporary += ".tmp";
+
+    std::error_code error;
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out << now->derived->line;
+        if (!out)
+            error = std::make_error_code(std::errc::io_error);
+    }
+    if (!error)
+        std::filesystem::rename(temporary, target, error);
+
+    // once; OBS holding the file open on windows fails a rename now and then, the next change retries
+    if (error && !warned)
+    {
+        fprintf(stderr, "now playing file: couldn't write %s: %s\n", path.c_str(), error.message().c_str());
+        warned = true;
+    }
+}
+
+std::string TextFileSink::PathFromArgs(int argc, char *argv[])
+{
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], "--now-playing-file") == 0)
+            return argv[i + 1];
+    }
+
+    const char *path = std::getenv("DMB_NOW_PLAYING_FILE");
+    return path ? path : "";
+}
+
+HistorySink *addBridgeSinks(PresencePipeline &pipeline, HistoryLog &history, const std::string &nowPlayingFile)
+{
+    pipeline.Add(std::make_unique<DiscordSink>());
+
+    HistorySink *historySink = nullptr;
+    if (history.IsOpen())
+    {
+        auto sink = std::make_unique<HistorySink>(history);
+        historySink = sink.get();
+        pipeline.Add(std::move(sink));
+    }
+    if (overlayEnabled())
+        pipeline.Add(std::make_unique<OverlaySink>());
+    if (!nowPlayingFile.empty())
+        pipeline.Add(std::make_unique<TextFileSink>(nowPlayingFile));
+    return historySink;
+}
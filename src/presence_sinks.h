@@ -0,0 +1,177 @@
+#pragma once
+
+#include "history_log.h"
+#include "metrics.h"
+#include "presence_bridge.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Where a poll tick goes once it's read: Discord, the history log, the overlay server, a text
+// file. Each sink has its own queue and worker thread, so one that's slow (an msync, a file OBS
+// has open) never holds up the others or the poll loop.
+
+// One poll tick and everything derived from it, built once on the poll thread and shared
+// read-only by every queue it's in. Ticks that change nothing share the last change's Derived,
+// and the snapshots themselves are reused once no queue holds them, so a steady tick allocates
+// nothing.
+struct NowPlaying
+{
+    struct Derived
+    {
+        PresenceText text;
+        DiscordRichPresence presence; // points into text
+        std::string line;             // "artist - title", empty when nothing's playing
+        std::shared_ptr<const std::string> artwork; // cover image bytes, only fetched if a sink or the window wants them
+        uint64_t artworkHash = 0;                   // Xxh64 of artwork: the overlay's url and the window's cache key
+    };
+
+    MusicInfo music;
+    std::chrono::steady_clock::time_point at;
+    bool changed = true; // track, tags, play state or cover differ from the tick before; the position moving doesn't count
+    std::shared_ptr<const Derived> derived;
+};
+
+class PresenceSink
+{
+public:
+    virtual ~PresenceSink() = default;
+
+    virtual SinkKind Kind() const = 0;
+    // unchanged ticks too, rather than only changes
+    virtual bool WantsEveryTick() const { return false; }
+    // have the cover fetched on a track change
+    virtual bool WantsArtwork() const { return false; }
+
+    // on the sink's worker, in order
+    virtual void Consume(const std::shared_ptr<const NowPlaying> &now) = 0;
+    // on the worker as the pipeline stops, after the last Consume
+    virtual void Finish() {}
+};
+
+class PresencePipeline
+{
+public:
+    // ticks a sink may fall behind by; past it the oldest unchanged one is dropped (and counted),
+    // as the tick after says the same thing with a later position. a changed one is only ever
+    // dropped for a sink that just wants the latest; for an every-tick sink a queue of nothing but
+    // changes grows instead, each could be a track boundary
+    static constexpr size_t QUEUE_LIMIT = 16;
+
+    PresencePipeline() = default;
+    ~PresencePipeline() { Stop(); }
+
+    PresencePipeline(const PresencePipeline &) = delete;
+    PresencePipeline &operator=(const PresencePipeline &) = delete;
+
+    // starts the sink's worker; all sinks are added before the first Publish
+    void Add(std::unique_ptr<PresenceSink> sink);
+
+    // poll thread: wraps music into a snapshot and queues it to every sink that wants it. ipc is
+    // only used to fetch the cover when the track changes and a sink wants it, or fetchArtwork
+    // asks for it anyway (the window, for a track it has no thumbnail of). Either way it's
+    // fetched and hashed once per track, into the snapshot's Derived
+    std::shared_ptr<const NowPlaying> Publish(MusicInfo music, MusicBeeIPC &ipc, bool fetchArtwork = false);
+
+    // lets every queue drain, then finishes and joins each sink's worker
+    void Stop();
+
+private:
+    struct Worker
+    {
+        std::unique_ptr<PresenceSink> sink;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<std::shared_ptr<const NowPlaying>> queue{QUEUE_LIMIT}; // a ring from head
+        size_t head = 0;
+        size_t queued = 0;
+        bool stopping = false;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::shared_ptr<NowPlaying>> snapshots; // every one made, for reuse
+    bool wantsArtwork = false;
+    std::shared_ptr<const NowPlaying> last;
+    MusicInfo artworkTrack; // the track the artwork below was fetched for
+    std::shared_ptr<const std::string> artwork;
+    uint64_t artworkHash = 0;
+
+    std::shared_ptr<NowPlaying> FreeSnapshot();
+    static void Run(Worker &worker);
+    static void Push(Worker &worker, const std::shared_ptr<const NowPlaying> &now);
+};
+
+// the presence, counted by PresenceTally while the metrics endpoint is up
+class DiscordSink : public PresenceSink
+{
+public:
+    SinkKind Kind() const override { return SinkKind::Discord; }
+    void Consume(const std::shared_ptr<const NowPlaying> &now) override;
+
+private:
+    PresenceTally tally;
+};
+
+// finished plays into the history log, through PlayTracker
+class HistorySink : public PresenceSink
+{
+public:
+    explicit HistorySink(HistoryLog &history) : history(history), tracker(history), plays(history.PlayCount()) {}
+
+    SinkKind Kind() const override { return SinkKind::History; }
+    bool WantsEveryTick() const override { return true; }
+    void Consume(const std::shared_ptr<const NowPlaying> &now) override;
+    void Finish() override;
+
+    // fn gets the log between appends, for reading it back from another thread. waits out an
+    // append and its flush, so only worth it once PlayCount has moved
+    void Read(const std::function<void(const HistoryLog &)> &fn);
+    // the log's play count after the last tick consumed, without the lock; cheap every tick
+    size_t PlayCount() const { return plays.load(std::memory_order_acquire); }
+
+private:
+    HistoryLog &history;
+    std::mutex mutex;
+    PlayTracker tracker;
+    std::atomic<size_t> plays;
+};
+
+// the overlay server's state and cover; every tick, so it can tell a seek from playback
+class OverlaySink : public PresenceSink
+{
+public:
+    SinkKind Kind() const override { return SinkKind::Overlay; }
+    bool WantsEveryTick() const override { return true; }
+    bool WantsArtwork() const override { return true; }
+    void Consume(const std::shared_ptr<const NowPlaying> &now) override;
+};
+
+// "artist - title" in a text file, for an OBS text source reading from file. Written to a
+// temporary file and renamed over, so OBS never reads half of it
+class TextFileSink : public PresenceSink
+{
+public:
+    explicit TextFileSink(const std::string &path) : path(path) {}
+
+    SinkKind Kind() const override { return SinkKind::TextFile; }
+    void Consume(const std::shared_ptr<const NowPlaying> &now) override;
+
+    // "--now-playing-file <file>" or DMB_NOW_PLAYING_FILE, empty if neither
+    static std::string PathFromArgs(int argc, char *argv[]);
+
+private:
+    std::string path;
+    bool warned = false;
+};
+
+// the sinks both builds run: Discord, the history if it's open, the overlay if it's up, and the
+// text file if nowPlayingFile isn't empty. returns the history sink, null without one
+HistorySink *addBridgeSinks(PresencePipeline &pipeline, HistoryLog &history, const std::string &nowPlayingFile);
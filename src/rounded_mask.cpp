@@ -0,0 +1,153 @@
+#include "rounded_mask.h"
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DMB_ROUNDED_SSE2
+#endif
+
+namespace
+{
+    const int SUBSAMPLES = 8; // per axis, so 64 coverage levels per pixel
+
+    // the top-left corner's rows, and the same rows mirrored for the right hand corners, so every
+    // corner row is a run of pixels against a run of coverage
+    struct CornerMask
+    {
+        std::vector<uint8_t> left;
+        std::vector<uint8_t> right;
+    };
+
+    // coverage of the top-left corner, radius x radius; the other three are mirror images
+    std::vector<uint8_t> rasterizeCorner(int radius)
+    {
+        std::vector<uint8_t> coverage(static_cast<size_t>(radius) * radius);
+        const double r2 = static_cast<double>(radius) * radius;
+
+        for (int y = 0; y < radius; ++y)
+        {
+            for (int x = 0; x < radius; ++x)
+            {
+                int inside = 0;
+                for (int sy = 0; sy < SUBSAMPLES; ++sy)
+                {
+                    const double dy = y + (sy + 0.5) / SUBSAMPLES - radius;
+                    for (int sx = 0; sx < SUBSAMPLES; ++sx)
+                    {
+                        const double dx = x + (sx + 0.5) / SUBSAMPLES - radius;
+                        if (dx * dx + dy * dy <= r2)
+                            ++inside;
+                    }
+                }
+                coverage[y * radius + x] = static_cast<uint8_t>((inside * 255 + SUBSAMPLES * SUBSAMPLES / 2) / (SUBSAMPLES * SUBSAMPLES));
+            }
+        }
+        return coverage;
+    }
+
+    const CornerMask &cornerMask(int radius)
+    {
+        // a handful of radii at most (one per display scale); entries are never removed, so the
+        // reference stays valid after the lock is dropped
+        static QMutex mutex;
+        static std::unordered_map<int, CornerMask> masks;
+
+        QMutexLocker locker(&mutex);
+        auto it = masks.find(radius);
+        if (it == masks.end())
+        {
+            CornerMask mask;
+            mask.left = rasterizeCorner(radius);
+            mask.right = mask.left;
+            for (int y = 0; y < radius; ++y)
+                std::reverse(mask.right.begin() + y * radius, mask.right.begin() + (y + 1) * radius);
+            it = masks.emplace(radius, std::move(mask)).first;
+        }
+        return it->second;
+    }
+
+    // all four channels of a premultiplied pixel times a/255: red+blue and alpha+green in one
+    // multiply each. the tail of a row, and all of it without sse2
+    inline uint32_t byteMul(uint32_t pixel, uint32_t a)
+    {
+        uint32_t rb = (pixel & 0x00ff00ff) * a;
+        rb = ((rb + ((rb >> 8) & 0x00ff00ff) + 0x00800080) >> 8) & 0x00ff00ff;
+
+        uint32_t ag = ((pixel >> 8) & 0x00ff00ff) * a;
+        ag = (ag + ((ag >> 8) & 0x00ff00ff) + 0x00800080) & 0xff00ff00;
+
+        return ag | rb;
+    }
+
+    inline void applyCoverage(uint32_t *pixel, uint8_t coverage)
+    {
+        if (coverage != 255)
+            *pixel = coverage ? byteMul(*pixel, coverage) : 0;
+    }
+
+    // count pixels times their coverage. with sse2 four at a time, every channel in a 16-bit lane
+    // and rounded exactly as byteMul does, so 255 keeps a pixel and 0 clears it without a branch
+    void applyCoverageRow(uint32_t *pixels, const uint8_t *coverage, int count)
+    {
+        int x = 0;
+#ifdef DMB_ROUNDED_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i half = _mm_set1_epi16(0x80);
+        for (; x + 4 <= count; x += 4)
+        {
+            // c0 c1 c2 c3 -> each repeated over its pixel's four bytes
+            uint32_t four;
+            memcpy(&four, coverage + x, sizeof(four));
+            __m128i a = _mm_cvtsi32_si128(static_cast<int>(four));
+            a = _mm_unpacklo_epi8(a, a);
+            a = _mm_unpacklo_epi16(a, a);
+
+            const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + x));
+            __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), _mm_unpacklo_epi8(a, zero));
+            __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), _mm_unpackhi_epi8(a, zero));
+            // (x + (x >> 8) + 0x80) >> 8, at most 65407 so nothing wraps
+            low = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), half), 8);
+            high = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), half), 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + x), _mm_packus_epi16(low, high));
+        }
+#endif
+        for (; x < count; ++x)
+            applyCoverage(pixels + x, coverage[x]);
+    }
+}
+
+void roundCorners(QImage &image, int radius)
+{
+    if (image.isNull())
+        return;
+
+    if (image.format() != QImage::Format_ARGB32_Premultiplied)
+        image.convertTo(QImage::Format_ARGB32_Premultiplied);
+
+    const int width = image.width();
+    const int height = image.height();
+    radius = std::min(radius, std::min(width, height) / 2);
+    if (radius <= 0)
+        return;
+
+    // radius is at most half of either side, so the four corners never overlap
+    const CornerMask &mask = cornerMask(radius);
+    for (int y = 0; y < radius; ++y)
+    {
+        const uint8_t *left = mask.left.data() + y * radius;
+        const uint8_t *right = mask.right.data() + y * radius;
+        uint32_t *top = reinterpret_cast<uint32_t *>(image.scanLine(y));
+        uint32_t *bottom = reinterpret_cast<uint32_t *>(image.scanLine(height - 1 - y));
+
+        applyCoverageRow(top, left, radius);
+        applyCoverageRow(top + width - radius, right, radius);
+        applyCoverageRow(bottom, left, radius);
+        applyCoverageRow(bottom + width - radius, right, radius);
+    }
+}
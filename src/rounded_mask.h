@@ -0,0 +1,10 @@
+#pragma once
+
+#include <QImage>
+
+// Rounds the corners of an image in place, radius in device pixels (clamped to half the shorter
+// side). The antialiased coverage of a corner is rasterized once per radius and cached; after that
+// only the pixels inside the four radius x radius corners are touched, each one multiplied by its
+// coverage: four pixels per step with SSE2, otherwise all four premultiplied channels in two 32-bit
+// multiplies. Safe to call from any thread. The image ends up as Format_ARGB32_Premultiplied.
+void roundCorners(QImage &image, int radius);
@@ -0,0 +1,85 @@
+#include "sha1.h"
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+    inline uint32_t rotl(uint32_t x, int r) { return (x << r) | (x >> (32 - r)); }
+
+    void compress(uint32_t state[5], const unsigned char *block)
+    {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i)
+            w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) | (uint32_t(block[i * 4 + 2]) << 8) | block[i * 4 + 3];
+        for (int i = 16; i < 80; ++i)
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (int i = 0; i < 80; ++i)
+        {
+            uint32_t f, k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            const uint32_t next = rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = next;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+void Sha1(const void *data, size_t length, unsigned char digest[20])
+{
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+
+    size_t remaining = length;
+    for (; remaining >= 64; remaining -= 64, p += 64)
+        compress(state, p);
+
+    // the tail, a 1 bit, zeros, and the length in bits big endian; one block or two
+    unsigned char tail[128] = {};
+    memcpy(tail, p, remaining);
+    tail[remaining] = 0x80;
+    const size_t tailBytes = remaining < 56 ? 64 : 128;
+    const uint64_t bits = static_cast<uint64_t>(length) * 8;
+    for (int i = 0; i < 8; ++i)
+        tail[tailBytes - 1 - i] = static_cast<unsigned char>(bits >> (i * 8));
+    compress(state, tail);
+    if (tailBytes == 128)
+        compress(state, tail + 64);
+
+    for (int i = 0; i < 5; ++i)
+    {
+        digest[i * 4] = static_cast<unsigned char>(state[i] >> 24);
+        digest[i * 4 + 1] = static_cast<unsigned char>(state[i] >> 16);
+        digest[i * 4 + 2] = static_cast<unsigned char>(state[i] >> 8);
+        digest[i * 4 + 3] = static_cast<unsigned char>(state[i]);
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+// SHA-1, for the WebSocket handshake (RFC 6455 fixes it as the accept key's hash). Broken for
+// anything security related, which the handshake isn't.
+void Sha1(const void *data, size_t length, unsigned char digest[20]);
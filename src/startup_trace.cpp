@@ -0,0 +1,134 @@
+#include "startup_trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    struct Mark
+    {
+        const char *phase;
+        double ms; // since process creation
+    };
+
+    const int MAX_MARKS = 16;
+    Mark marks[MAX_MARKS];
+    int markCount = 0;
+
+#ifdef _WIN32
+    uint64_t fileTimeTo100ns(const FILETIME &time)
+    {
+        return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    }
+
+    double processAgeMs()
+    {
+        FILETIME created, exited, kernel, user, now;
+        GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+        GetSystemTimeAsFileTime(&now);
+        return (fileTimeTo100ns(now) - fileTimeTo100ns(created)) / 10000.0;
+    }
+
+    void residentBytes(size_t *current, size_t *peak)
+    {
+        PROCESS_MEMORY_COUNTERS memory;
+        memset(&memory, 0, sizeof(memory));
+        GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory));
+        *current = memory.WorkingSetSize;
+        *peak = memory.PeakWorkingSetSize;
+    }
+#else
+    // start time is field 22 of /proc/self/stat, in clock ticks since boot
+    double processAgeMs()
+    {
+        FILE *stat = fopen("/proc/self/stat", "r");
+        if (!stat)
+            return 0;
+
+        char buffer[1024];
+        const size_t length = fread(buffer, 1, sizeof(buffer) - 1, stat);
+        fclose(stat);
+        buffer[length] = '\0';
+
+        // the command name can hold spaces and parens, fields are counted from after its closing paren
+        const char *field = strrchr(buffer, ')');
+        unsigned long long startTicks = 0;
+        if (!field || sscanf(field + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &startTicks) != 1)
+            return 0;
+
+        timespec now;
+        clock_gettime(CLOCK_BOOTTIME, &now);
+        const double nowMs = now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+        return nowMs - startTicks * 1000.0 / sysconf(_SC_CLK_TCK);
+    }
+
+    void residentBytes(size_t *current, size_t *peak)
+    {
+        *current = 0;
+        if (FILE *statm = fopen("/proc/self/statm", "r"))
+        {
+            unsigned long long pages = 0;
+            if (fscanf(statm, "%*s %llu", &pages) == 1) // skip the total size
+                *current = static_cast<size_t>(pages) * sysconf(_SC_PAGESIZE);
+            fclose(statm);
+        }
+
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        *peak = static_cast<size_t>(usage.ru_maxrss) * 1024;
+    }
+#endif
+
+    // the process creation time is coarse (system clock ticks, or 10 ms on linux), so it's read
+    // once and the steady clock does the rest
+    double msSinceProcessCreated()
+    {
+        static const auto origin = std::chrono::steady_clock::now();
+        static const double originMs = processAgeMs();
+
+        return originMs + std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - origin).count();
+    }
+}
+
+void markStartup(const char *phase)
+{
+    const double ms = msSinceProcessCreated();
+    if (markCount < MAX_MARKS)
+        marks[markCount++] = {phase, ms};
+}
+
+std::string describeStartup()
+{
+    std::string line = "startup:";
+    char part[96];
+    double previousMs = 0;
+    for (int i = 0; i < markCount; ++i)
+    {
+        snprintf(part, sizeof(part), i == 0 ? " %s %.0f ms" : ", %s +%.0f ms", marks[i].phase, marks[i].ms - previousMs);
+        line += part;
+        previousMs = marks[i].ms;
+    }
+
+    size_t current, peak;
+    residentBytes(&current, &peak);
+    snprintf(part, sizeof(part), " = %.0f ms, working set %llu KB, peak %llu KB", previousMs,
+             static_cast<unsigned long long>(current / 1024), static_cast<unsigned long long>(peak / 1024));
+    line += part;
+    return line;
+}
+
+size_t workingSetBytes()
+{
+    size_t current, peak;
+    residentBytes(&current, &peak);
+    return current;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Startup milestones, timed from process creation so dll loading before main is counted too.
+// Main thread only; marks past the first 16 are dropped.
+void markStartup(const char *phase);
+
+// "startup: main 41 ms, discord +2 ms, ... = 97 ms, working set N KB, peak N KB"
+std::string describeStartup();
+
+// current working set, for before/after comparisons
+size_t workingSetBytes();
@@ -0,0 +1,61 @@
+#include "tag.h"
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace
+{
+    struct TagTable
+    {
+        std::shared_mutex mutex;
+        std::deque<std::string> texts; // a deque, so adding one never moves the others
+        std::unordered_map<std::string_view, uint32_t> ids; // views into texts
+    };
+
+    // never destroyed: tags can outlive any static that would hold it
+    TagTable &table()
+    {
+        static TagTable *tags = new TagTable();
+        return *tags;
+    }
+}
+
+Tag::Tag(std::string_view value)
+{
+    if (value.empty())
+        return;
+
+    TagTable &tags = table();
+    {
+        // nearly every lookup is a tag already seen, the same artist tick after tick
+        std::shared_lock<std::shared_mutex> lock(tags.mutex);
+        const auto found = tags.ids.find(value);
+        if (found != tags.ids.end())
+        {
+            text = found->first.data();
+            length = static_cast<uint32_t>(found->first.size());
+            id = found->second;
+            return;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(tags.mutex);
+    auto found = tags.ids.find(value); // another thread may have added it in between
+    if (found == tags.ids.end())
+    {
+        tags.texts.emplace_back(value);
+        found = tags.ids.emplace(tags.texts.back(), static_cast<uint32_t>(tags.texts.size())).first;
+    }
+    text = found->first.data();
+    length = static_cast<uint32_t>(found->first.size());
+    id = found->second;
+}
+
+size_t Tag::Count()
+{
+    TagTable &tags = table();
+    std::shared_lock<std::shared_mutex> lock(tags.mutex);
+    return tags.texts.size();
+}
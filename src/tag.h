@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// A tag value (artist, album, title, file url) interned in one process-wide table: every distinct
+// text is stored once and gets a stable id, so equal tags are equal ids. Copying a Tag copies a
+// pointer and an id, comparing two is comparing ids, and an album played through hands the same
+// artist and album to every track without copying the text. The table only grows, by the tags
+// this session actually plays, and its text never moves, so data() stays valid for good.
+class Tag
+{
+public:
+    Tag() = default; // the empty tag, id 0; no lookup
+    // looks the text up, adding it the first time; safe from any thread
+    explicit Tag(std::string_view value);
+
+    uint32_t Id() const { return id; }
+
+    const char *data() const { return text; }
+    const char *c_str() const { return text; }
+    size_t size() const { return length; }
+    bool empty() const { return id == 0; }
+    std::string_view view() const { return std::string_view(text, length); }
+    operator std::string_view() const { return view(); }
+
+    friend bool operator==(const Tag &a, const Tag &b) { return a.id == b.id; }
+    friend bool operator!=(const Tag &a, const Tag &b) { return a.id != b.id; }
+    friend bool operator==(const Tag &a, std::string_view b) { return a.view() == b; }
+    friend bool operator!=(const Tag &a, std::string_view b) { return a.view() != b; }
+
+    // distinct non-empty tags interned so far; ids run 1..Count()
+    static size_t Count();
+
+private:
+    const char *text = "";
+    uint32_t length = 0;
+    uint32_t id = 0;
+};
@@ -0,0 +1,197 @@
+#include "thumbnail_disk_cache.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QMutexLocker>
+#include <unordered_set>
+
+namespace
+{
+    // index lines are "<16 hex digit key>\t<file url>\n"; file paths can't contain tabs or newlines
+    constexpr int KEY_HEX_DIGITS = 16;
+
+    QString keyName(uint64_t key)
+    {
+        return QString::number(static_cast<qulonglong>(key), 16).rightJustified(KEY_HEX_DIGITS, '0');
+    }
+}
+
+ThumbnailDiskCache::ThumbnailDiskCache(const QString &directory, qint64 budgetBytes)
+    : directory(directory), budgetBytes(budgetBytes)
+{
+    QDir().mkpath(directory);
+    writer.setMaxThreadCount(1);
+    // the index is small and needed for the very first paint, so read it right here
+    LoadIndex();
+}
+
+ThumbnailDiskCache::~ThumbnailDiskCache()
+{
+    writer.waitForDone();
+}
+
+QString ThumbnailDiskCache::DefaultDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/thumbnails";
+}
+
+bool ThumbnailDiskCache::FindKey(const std::string &fileUrl, uint64_t *key) const
+{
+    if (fileUrl.empty())
+        return false;
+
+    QMutexLocker lock(&mutex);
+    auto it = urlIndex.find(fileUrl);
+    if (it == urlIndex.end())
+        return false;
+    *key = it->second;
+    return true;
+}
+
+QImage ThumbnailDiskCache::Load(uint64_t key) const
+{
+    QImage image;
+    image.load(ThumbnailPath(key), "PNG");
+    return image;
+}
+
+void ThumbnailDiskCache::Store(uint64_t key, const std::string &fileUrl, const QImage &image)
+{
+    if (image.isNull())
+        return;
+
+    writer.start([this, key, fileUrl, image]()
+                 { Write(key, fileUrl, image); });
+}
+
+QString ThumbnailDiskCache::ThumbnailPath(uint64_t key) const
+{
+    return directory + "/" + keyName(key) + ".png";
+}
+
+QString ThumbnailDiskCache::IndexPath() const
+{
+    return directory + "/index.tsv";
+}
+
+void ThumbnailDiskCache::LoadIndex()
+{
+    QFile file(IndexPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    // later lines win, a url whose artwork changed just gets appended again
+    const QByteArray contents = file.readAll();
+    qsizetype lineStart = 0;
+    while (lineStart < contents.size())
+    {
+        qsizetype lineEnd = contents.indexOf('\n', lineStart);
+        if (lineEnd < 0)
+            lineEnd = contents.size();
+
+        const qsizetype tab = lineStart + KEY_HEX_DIGITS;
+        if (tab < lineEnd && contents[tab] == '\t')
+        {
+            bool ok = false;
+            uint64_t key = contents.mid(lineStart, KEY_HEX_DIGITS).toULongLong(&ok, 16);
+            if (ok)
+                urlIndex[std::string(contents.constData() + tab + 1, lineEnd - tab - 1)] = key;
+        }
+        lineStart = lineEnd + 1;
+    }
+}
+
+void ThumbnailDiskCache::Write(uint64_t key, const std::string &fileUrl, const QImage &image)
+{
+    const QString path = ThumbnailPath(key);
+    if (!QFileInfo::exists(path))
+    {
+        // PNG keeps the rounded corners' alpha and a 150x150 one decodes in well under a millisecond
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || !image.save(&file, "PNG") || !file.commit())
+            return;
+
+        if (totalBytes >= 0)
+            totalBytes += QFileInfo(path).size();
+        EvictOverBudget();
+    }
+
+    if (fileUrl.empty())
+        return;
+
+    {
+        QMutexLocker lock(&mutex);
+        auto it = urlIndex.find(fileUrl);
+        if (it != urlIndex.end() && it->second == key)
+            return;
+        urlIndex[fileUrl] = key;
+    }
+
+    QFile index(IndexPath());
+    if (index.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        QByteArray line = keyName(key).toLatin1();
+        line += '\t';
+        line.append(fileUrl.data(), static_cast<qsizetype>(fileUrl.size()));
+        line += '\n';
+        index.write(line);
+    }
+}
+
+void ThumbnailDiskCache::EvictOverBudget()
+{
+    QDir dir(directory);
+    QFileInfoList thumbnails;
+
+    if (totalBytes < 0)
+    {
+        thumbnails = dir.entryInfoList({"*.png"}, QDir::Files, QDir::Time | QDir::Reversed);
+        totalBytes = 0;
+        for (const QFileInfo &info : thumbnails)
+            totalBytes += info.size();
+    }
+
+    if (totalBytes <= budgetBytes)
+        return;
+
+    if (thumbnails.isEmpty())
+        thumbnails = dir.entryInfoList({"*.png"}, QDir::Files, QDir::Time | QDir::Reversed);
+
+    // oldest first, and go a bit under budget so we aren't back here on the very next write
+    const qint64 target = budgetBytes - budgetBytes / 10;
+    std::unordered_set<uint64_t> evicted;
+    for (const QFileInfo &info : thumbnails)
+    {
+        if (totalBytes <= target)
+            break;
+        if (QFile::remove(info.absoluteFilePath()))
+        {
+            totalBytes -= info.size();
+            evicted.insert(info.baseName().toULongLong(nullptr, 16));
+        }
+    }
+
+    // rewrite the index without the urls that now point at nothing
+    QMutexLocker lock(&mutex);
+    QSaveFile index(IndexPath());
+    if (!index.open(QIODevice::WriteOnly))
+        return;
+
+    for (auto it = urlIndex.begin(); it != urlIndex.end();)
+    {
+        if (evicted.count(it->second))
+        {
+            it = urlIndex.erase(it);
+            continue;
+        }
+        QByteArray line = keyName(it->second).toLatin1();
+        line += '\t';
+        line.append(it->first.data(), static_cast<qsizetype>(it->first.size()));
+        line += '\n';
+        index.write(line);
+        ++it;
+    }
+    index.commit();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Finished artwork thumbnails kept on disk between runs, one PNG per artwork hash (the same key
+// ArtworkCache uses), plus an index from track file URL to hash so a known track can show its
+// cover before its artwork is pulled over IPC at all. Oldest written thumbnails are removed once
+// the directory goes over budget. Writes and eviction happen on a background thread.
+class ThumbnailDiskCache
+{
+public:
+    ThumbnailDiskCache(const QString &directory, qint64 budgetBytes);
+    ~ThumbnailDiskCache();
+
+    // <app local data>/thumbnails, needs the QApplication to exist for the app name
+    static QString DefaultDirectory();
+
+    bool FindKey(const std::string &fileUrl, uint64_t *key) const;
+    // null image if the thumbnail isn't on disk (never stored, or evicted)
+    QImage Load(uint64_t key) const;
+    // Remembers fileUrl -> key and writes the thumbnail if it isn't on disk yet. Returns straight
+    // away, the image is copied.
+    void Store(uint64_t key, const std::string &fileUrl, const QImage &image);
+
+private:
+    QString directory;
+    qint64 budgetBytes;
+    // guards urlIndex, which the writer thread updates on store and eviction
+    mutable QMutex mutex;
+    std::unordered_map<std::string, uint64_t> urlIndex;
+    qint64 totalBytes = -1; // writer thread only, -1 until the directory has been measured
+    QThreadPool writer;
+
+    QString ThumbnailPath(uint64_t key) const;
+    QString IndexPath() const;
+    void LoadIndex();
+    void Write(uint64_t key, const std::string &fileUrl, const QImage &image);
+    void EvictOverBudget();
+};
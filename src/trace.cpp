@@ -0,0 +1,249 @@
+#include "trace.h"
+#include "discord_rpc.h"
+#include "rapidjson/filewritestream.h"
+#include "rapidjson/writer.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    const uint64_t RING_EVENTS = 8192; // per thread, a power of two
+    const int MAX_HOOK_DEPTH = 8;      // discord-rpc's begin/end nesting
+
+    struct Event
+    {
+        const char *name;
+        long long startNs;
+        long long durationNs; // -1 for an instant
+    };
+
+    // written only by its own thread; the count is published after the slot so a reader at
+    // exit sees whole events
+    struct Ring
+    {
+        int id = 0;
+        std::atomic<const char *> threadName{nullptr};
+        std::atomic<uint64_t> written{0};
+        Event events[RING_EVENTS];
+    };
+
+    std::atomic_bool enabled{false};
+    std::string tracePath;
+    const auto epoch = std::chrono::steady_clock::now();
+
+    // rings are never freed, a thread that has exited still has its spans written out
+    std::mutex ringsMutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    thread_local Ring *threadRing = nullptr;
+
+    struct HookSpan
+    {
+        const char *name;
+        long long startNs;
+    };
+    thread_local HookSpan hookStack[MAX_HOOK_DEPTH];
+    thread_local int hookDepth = 0;
+
+    long long nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    Ring *ring()
+    {
+        if (!threadRing)
+        {
+            std::unique_ptr<Ring> created(new Ring());
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            created->id = static_cast<int>(rings.size()) + 1;
+            threadRing = created.get();
+            rings.push_back(std::move(created));
+        }
+        return threadRing;
+    }
+
+    void record(const char *name, long long startNs, long long durationNs)
+    {
+        Ring *target = ring();
+        const uint64_t index = target->written.load(std::memory_order_relaxed);
+        target->events[index & (RING_EVENTS - 1)] = {name, startNs, durationNs};
+        target->written.store(index + 1, std::memory_order_release);
+    }
+
+    // discord-rpc's io thread reports through plain callbacks, kept on a small per-thread stack
+    void onHookThreadStarted(const char *name)
+    {
+        traceThreadName(name);
+    }
+
+    void onHookBegin(const char *name)
+    {
+        if (hookDepth < MAX_HOOK_DEPTH)
+            hookStack[hookDepth] = {name, enabled.load(std::memory_order_relaxed) ? nowNs() : 0};
+        ++hookDepth;
+    }
+
+    void onHookEnd()
+    {
+        if (hookDepth == 0)
+            return;
+        --hookDepth;
+        if (hookDepth < MAX_HOOK_DEPTH && hookStack[hookDepth].startNs)
+            record(hookStack[hookDepth].name, hookStack[hookDepth].startNs, nowNs() - hookStack[hookDepth].startNs);
+    }
+
+    void writeEvent(rapidjson::Writer<rapidjson::FileWriteStream> &writer, const Ring &source, const Event &event)
+    {
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(event.name);
+        writer.Key("ph");
+        writer.String(event.durationNs < 0 ? "i" : "X");
+        writer.Key("ts");
+        writer.Double(event.startNs / 1000.0); // chrome wants microseconds
+        if (event.durationNs < 0)
+        {
+            writer.Key("s");
+            writer.String("t");
+        }
+        else
+        {
+            writer.Key("dur");
+            writer.Double(event.durationNs / 1000.0);
+        }
+        writer.Key("pid");
+        writer.Int(1);
+        writer.Key("tid");
+        writer.Int(source.id);
+        writer.EndObject();
+    }
+
+    void writeThreadName(rapidjson::Writer<rapidjson::FileWriteStream> &writer, const Ring &source)
+    {
+        const char *name = source.threadName.load(std::memory_order_acquire);
+        if (!name)
+            return;
+        writer.StartObject();
+        writer.Key("name");
+        writer.String("thread_name");
+        writer.Key("ph");
+        writer.String("M");
+        writer.Key("pid");
+        writer.Int(1);
+        writer.Key("tid");
+        writer.Int(source.id);
+        writer.Key("args");
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(name);
+        writer.EndObject();
+        writer.EndObject();
+    }
+}
+
+void startTrace(const std::string &path)
+{
+    if (path.empty() || enabled)
+        return;
+    tracePath = path;
+
+    // must be in place before Discord_Initialize starts the io thread
+    DiscordTraceHooks hooks;
+    memset(&hooks, 0, sizeof(hooks));
+    hooks.threadStarted = onHookThreadStarted;
+    hooks.begin = onHookBegin;
+    hooks.end = onHookEnd;
+    hooks.instant = traceInstant;
+    Discord_SetTraceHooks(&hooks);
+
+    enabled = true;
+}
+
+void startTraceFromArgs(int argc, char *argv[])
+{
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], "--trace") == 0)
+        {
+            startTrace(argv[i + 1]);
+            return;
+        }
+    }
+
+    const char *path = std::getenv("DMB_TRACE");
+    if (path)
+        startTrace(path);
+}
+
+bool traceEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void traceThreadName(const char *name)
+{
+    if (traceEnabled())
+        ring()->threadName.store(name, std::memory_order_release);
+}
+
+void traceInstant(const char *name)
+{
+    if (traceEnabled())
+        record(name, nowNs(), -1);
+}
+
+bool writeTrace()
+{
+    if (!traceEnabled())
+        return false;
+
+    FILE *file = fopen(tracePath.c_str(), "wb");
+    if (!file)
+        return false;
+
+    char buffer[64 * 1024];
+    rapidjson::FileWriteStream stream(file, buffer, sizeof(buffer));
+    rapidjson::Writer<rapidjson::FileWriteStream> writer(stream);
+
+    writer.StartObject();
+    writer.Key("displayTimeUnit");
+    writer.String("ms");
+    writer.Key("traceEvents");
+    writer.StartArray();
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (const auto &source : rings)
+        {
+            writeThreadName(writer, *source);
+
+            // the newest RING_EVENTS, oldest first
+            const uint64_t written = source->written.load(std::memory_order_acquire);
+            const uint64_t first = written > RING_EVENTS ? written - RING_EVENTS : 0;
+            for (uint64_t i = first; i < written; ++i)
+                writeEvent(writer, *source, source->events[i & (RING_EVENTS - 1)]);
+        }
+    }
+    writer.EndArray();
+    writer.EndObject();
+    stream.Flush();
+
+    const bool ok = ferror(file) == 0;
+    return fclose(file) == 0 && ok;
+}
+
+TraceSpan::TraceSpan(const char *name) : name(name), startNs(traceEnabled() ? nowNs() : 0)
+{
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (startNs)
+        record(name, startNs, nowNs() - startNs);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+// Spans over the poll -> presence cycle, written out as Chrome trace-event JSON (load it in
+// chrome://tracing or ui.perfetto.dev). Off unless DMB_TRACE=<file> is set or --trace <file> is
+// passed; while off a span costs one relaxed load. Each thread records into a ring of its own, so
+// nothing is locked on the hot path and only the newest 8192 spans per thread are kept.
+
+// start recording, the file is written by writeTrace. also hooks discord-rpc's io thread
+void startTrace(const std::string &path);
+
+// startTrace on DMB_TRACE or "--trace <file>", whichever is given (the flag wins)
+void startTraceFromArgs(int argc, char *argv[]);
+
+bool traceEnabled();
+
+// names the calling thread in the trace, e.g. "gui", "artwork"
+void traceThreadName(const char *name);
+
+// zero-length marker, e.g. discord acknowledging a presence
+void traceInstant(const char *name);
+
+// writes every thread's ring to the startTrace file; false if tracing is off or the write failed
+bool writeTrace();
+
+// times its own scope. name must outlive the trace (a string literal)
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    long long startNs; // 0 when tracing was off at construction
+};
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 (https://github.com/Cyan4973/xxHash). Fast and stable across runs and machines, which is
+// what content addressing needs; not for anything security related.
+uint64_t Xxh64(const void *data, size_t length, uint64_t seed = 0);
@@ -0,0 +1,234 @@
+// The io thread -> Discord_RunCallbacks queue under load: a fake discord on a unix socket floods
+// the client with ACTIVITY_JOIN events while this thread drains them, then sends batches of
+// exactly one queue's worth. Every event must come out once and in order, the ones that found the
+// queue full included, and after the overflow all of the queue's slots must still be usable.
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "check.h"
+#include "discord_rpc.h"
+#include "rpc_connection.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // CallbackQueueSize in discord_rpc.cpp
+    const int QUEUE_SIZE = 64;
+    // far more than the callback side can take between two drains, so the queue overflows; not
+    // more than the io side holds on to meanwhile (CallbackOverflowLimit)
+    const int FLOOD_EVENTS = 1024;
+    const int BATCHES = 6;
+    const int BATCH_FIRST_SECRET = 1000000;
+
+    std::vector<long> received;
+    std::atomic<int> ready{0};
+    std::atomic<int> disconnects{0};
+
+    void onReady(const DiscordUser *) { ++ready; }
+    void onDisconnected(int, const char *) { ++disconnects; }
+    void onJoinGame(const char *secret) { received.push_back(strtol(secret, nullptr, 10)); }
+
+    bool sendFrame(int socket, RpcConnection::Opcode opcode, const std::string &body)
+    {
+        std::string frame(sizeof(RpcConnection::MessageFrameHeader), '\0');
+        const RpcConnection::MessageFrameHeader header{opcode, static_cast<uint32_t>(body.size())};
+        memcpy(&frame[0], &header, sizeof(header));
+        frame += body;
+        return send(socket, frame.data(), frame.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(frame.size());
+    }
+
+    bool readFrame(int socket)
+    {
+        RpcConnection::MessageFrameHeader header{};
+        if (recv(socket, &header, sizeof(header), MSG_WAITALL) != static_cast<ssize_t>(sizeof(header)))
+            return false;
+        std::string body(header.length, '\0');
+        return header.length == 0 || recv(socket, &body[0], body.size(), MSG_WAITALL) == static_cast<ssize_t>(body.size());
+    }
+
+    // one frame per send, so the client never sees half a frame
+    bool sendJoins(int socket, int firstSecret, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            const std::string body = "{\"cmd\":\"DISPATCH\",\"evt\":\"ACTIVITY_JOIN\",\"data\":{\"secret\":\"" +
+                                     std::to_string(firstSecret + i) + "\"}}";
+            if (!sendFrame(socket, RpcConnection::Opcode::Frame, body))
+                return false;
+        }
+        return true;
+    }
+
+    struct FakeDiscord
+    {
+        int server = -1;
+        std::thread thread;
+        // bumped by the test to let the server send its next burst: 1 the flood, 2.. the batches
+        std::atomic<int> go{0};
+        std::atomic<int> sent{0};
+        std::atomic<bool> failed{false};
+
+        void Run()
+        {
+            const int client = accept(server, nullptr, nullptr);
+            const std::string readyBody = "{\"cmd\":\"DISPATCH\",\"evt\":\"READY\",\"data\":{\"v\":1,\"user\":"
+                                          "{\"id\":\"1\",\"username\":\"flood\",\"discriminator\":\"0\"}}}";
+            if (client < 0 || !readFrame(client) || !sendFrame(client, RpcConnection::Opcode::Frame, readyBody))
+            {
+                failed = true;
+                if (client >= 0)
+                    close(client);
+                return;
+            }
+
+            for (int burst = 1; burst <= 1 + BATCHES; ++burst)
+            {
+                while (go.load() < burst)
+                {
+                    if (go.load() < 0)
+                    {
+                        close(client);
+                        return;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                const bool ok = burst == 1 ? sendJoins(client, 0, FLOOD_EVENTS)
+                                           : sendJoins(client, BATCH_FIRST_SECRET + (burst - 2) * QUEUE_SIZE, QUEUE_SIZE);
+                if (!ok)
+                    failed = true;
+                sent = burst;
+            }
+
+            while (go.load() >= 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            close(client);
+        }
+    };
+
+    // drains until nothing has arrived for a while: the io thread wakes every 500 ms, so whatever
+    // the server has written is in by then
+    void drainUntilQuiet(std::chrono::milliseconds pause)
+    {
+        size_t seen = received.size();
+        auto lastEvent = Clock::now();
+        while (Clock::now() - lastEvent < std::chrono::milliseconds(1500))
+        {
+            Discord_RunCallbacks();
+            if (received.size() != seen)
+            {
+                seen = received.size();
+                lastEvent = Clock::now();
+            }
+            std::this_thread::sleep_for(pause);
+        }
+    }
+
+    template <typename Done>
+    bool drainUntil(Done &&done)
+    {
+        const auto deadline = Clock::now() + std::chrono::seconds(10);
+        while (!done())
+        {
+            if (Clock::now() > deadline)
+                return false;
+            Discord_RunCallbacks();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+}
+
+int main()
+{
+    char dir[] = "/tmp/dmb_callback_queue_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        fprintf(stderr, "no temp dir\n");
+        return 1;
+    }
+    setenv("XDG_RUNTIME_DIR", dir, 1);
+
+    const std::string socketPath = std::string(dir) + "/discord-ipc-0";
+    FakeDiscord discord;
+    discord.server = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath.c_str());
+    if (discord.server < 0 || bind(discord.server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(discord.server, 1) != 0)
+    {
+        fprintf(stderr, "no unix socket\n");
+        rmdir(dir);
+        return 1;
+    }
+    discord.thread = std::thread([&discord]()
+                                 { discord.Run(); });
+
+    DiscordEventHandlers handlers{};
+    handlers.ready = onReady;
+    handlers.disconnected = onDisconnected;
+    handlers.joinGame = onJoinGame;
+    Discord_Initialize("123456789012345678", &handlers, 0, nullptr);
+
+    CHECK(drainUntil([]()
+                     { return ready.load() == 1; }),
+          "never connected");
+
+    // the flood, left undrained until the io thread has read all of it, so all but a queue's
+    // worth has to wait on the io side; then drained every few milliseconds
+    discord.go = 1;
+    const auto floodDeadline = Clock::now() + std::chrono::seconds(10);
+    while (discord.sent.load() < 1 && Clock::now() < floodDeadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(discord.sent.load() == 1, "flood not sent");
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    drainUntilQuiet(std::chrono::milliseconds(5));
+    const size_t flooded = received.size();
+    CHECK(flooded == static_cast<size_t>(FLOOD_EVENTS), "%zu of %d flood events came through", flooded, FLOOD_EVENTS);
+    for (size_t i = 0; i < flooded; ++i)
+    {
+        CHECK(received[i] == static_cast<long>(i), "got %ld where %zu belongs", received[i], i);
+        if (received[i] != static_cast<long>(i))
+            break;
+    }
+    CHECK(Discord_GetDroppedEvents() == 0, "%d events dropped", Discord_GetDroppedEvents());
+
+    // with the queue empty again, a full queue's worth must all get in: a slot lost to the
+    // overflow would drop the last event of every batch
+    for (int batch = 0; batch < BATCHES; ++batch)
+    {
+        const size_t before = received.size();
+        discord.go = 2 + batch;
+        const bool complete = drainUntil([&]()
+                                         { return received.size() >= before + QUEUE_SIZE; });
+        CHECK(complete, "batch %d: %zu of %d events came through", batch, received.size() - before, QUEUE_SIZE);
+        if (!complete)
+            break;
+        for (int i = 0; i < QUEUE_SIZE; ++i)
+        {
+            const long expected = BATCH_FIRST_SECRET + batch * QUEUE_SIZE + i;
+            CHECK(received[before + i] == expected, "batch %d: got %ld where %ld belongs", batch, received[before + i], expected);
+        }
+    }
+
+    CHECK(disconnects.load() == 0, "the connection dropped");
+    CHECK(!discord.failed.load(), "the fake discord could not write");
+
+    discord.go = -1;
+    Discord_Shutdown();
+    shutdown(discord.server, SHUT_RDWR); // in case the client never connected
+    discord.thread.join();
+    close(discord.server);
+    unlink(socketPath.c_str());
+    rmdir(dir);
+    return TestResult("callback_queue");
+}
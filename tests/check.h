@@ -0,0 +1,33 @@
+#pragma once
+
+// What the test executables share: CHECK reports a failed condition and keeps going, and main
+// returns TestResult(), so ctest sees a nonzero exit if anything failed.
+
+#include <cstdio>
+
+inline int &TestFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition, ...)                                                   \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #condition); \
+            fprintf(stderr, __VA_ARGS__);                                       \
+            fprintf(stderr, "\n");                                              \
+            ++TestFailures();                                                   \
+        }                                                                       \
+    } while (0)
+
+inline int TestResult(const char *name)
+{
+    if (TestFailures())
+        fprintf(stderr, "%s: %d check(s) failed\n", name, TestFailures());
+    else
+        printf("%s: ok\n", name);
+    return TestFailures() ? 1 : 0;
+}
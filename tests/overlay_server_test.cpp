@@ -0,0 +1,208 @@
+// The overlay server on 127.0.0.1, spoken to over plain sockets the way OBS and a browser would:
+// the now playing JSON, the WebSocket handshake and a push when the track changes, the cover's
+// ETag and 304, and the 403s for a foreign Origin or a Host only dns rebinding would send.
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include "check.h"
+#include "overlay_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace
+{
+    // RFC 6455's own example
+    const char *WEBSOCKET_KEY = "dGhlIHNhbXBsZSBub25jZQ==";
+    const char *WEBSOCKET_ACCEPT = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+    int port = 0;
+
+    int connectOverlay()
+    {
+        const int client = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        timeval timeout{2, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (client >= 0 && connect(client, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            close(client);
+            return -1;
+        }
+        return client;
+    }
+
+    bool sendAll(int client, const std::string &data)
+    {
+        return send(client, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+    }
+
+    std::string request(const std::string &path, const std::string &headers = "")
+    {
+        std::string text = "GET " + path + " HTTP/1.1\r\n";
+        if (headers.find("Host:") == std::string::npos)
+            text += "Host: 127.0.0.1:" + std::to_string(port) + "\r\n";
+        return text + headers + "\r\n";
+    }
+
+    // status line, headers and body, up to the server closing; plain responses are Connection: close
+    std::string get(const std::string &path, const std::string &headers = "")
+    {
+        const int client = connectOverlay();
+        if (client < 0 || !sendAll(client, request(path, headers)))
+        {
+            if (client >= 0)
+                close(client);
+            return std::string();
+        }
+        std::string response;
+        char buffer[4096];
+        ssize_t got;
+        while ((got = recv(client, buffer, sizeof(buffer), 0)) > 0)
+            response.append(buffer, static_cast<size_t>(got));
+        close(client);
+        return response;
+    }
+
+    std::string statusOf(const std::string &response)
+    {
+        return response.substr(0, response.find("\r\n"));
+    }
+
+    std::string bodyOf(const std::string &response)
+    {
+        const size_t end = response.find("\r\n\r\n");
+        return end == std::string::npos ? std::string() : response.substr(end + 4);
+    }
+
+    bool recvExactly(int client, char *out, size_t size)
+    {
+        size_t done = 0;
+        while (done < size)
+        {
+            const ssize_t got = recv(client, out + done, size - done, 0);
+            if (got <= 0)
+                return false;
+            done += static_cast<size_t>(got);
+        }
+        return true;
+    }
+
+    // one unmasked text frame from the server, empty on timeout
+    std::string readFrame(int client)
+    {
+        unsigned char header[2];
+        if (!recvExactly(client, reinterpret_cast<char *>(header), 2) || header[0] != 0x81)
+            return std::string();
+        size_t length = header[1] & 0x7F;
+        if (length == 126)
+        {
+            unsigned char extended[2];
+            if (!recvExactly(client, reinterpret_cast<char *>(extended), 2))
+                return std::string();
+            length = (static_cast<size_t>(extended[0]) << 8) | extended[1];
+        }
+        std::string payload(length, '\0');
+        return recvExactly(client, &payload[0], length) ? payload : std::string();
+    }
+
+    MusicInfo playing(const char *title)
+    {
+        MusicInfo music;
+        music.musicBeeRunning = true;
+        music.isPlaying = true;
+        music.playState = MBPlayState::Playing;
+        music.title = Tag(title);
+        music.artist = Tag("Overlay Test");
+        music.album = Tag("Localhost");
+        music.positionMs = 1000;
+        music.durationMs = 180000;
+        return music;
+    }
+}
+
+int main()
+{
+    if (!startOverlay("127.0.0.1:0"))
+    {
+        fprintf(stderr, "couldn't start the overlay server\n");
+        return 1;
+    }
+    port = overlayPort();
+    CHECK(port > 0, "no port for 127.0.0.1:0");
+
+    // the state as JSON
+    publishNowPlaying(playing("First Song"));
+    const std::string nowPlaying = get("/now-playing");
+    CHECK(statusOf(nowPlaying) == "HTTP/1.1 200 OK", "/now-playing: %s", statusOf(nowPlaying).c_str());
+    CHECK(nowPlaying.find("Content-Type: application/json") != std::string::npos, "/now-playing isn't json");
+    CHECK(nowPlaying.find("Access-Control-Allow-Origin") == std::string::npos, "/now-playing allows any origin");
+    const std::string json = bodyOf(nowPlaying);
+    CHECK(json.find("\"playing\":true") != std::string::npos && json.find("\"title\":\"First Song\"") != std::string::npos &&
+              json.find("\"artwork\":null") != std::string::npos,
+          "/now-playing body: %s", json.c_str());
+
+    // the handshake, the state on connecting, then one push for a new track
+    const int webSocket = connectOverlay();
+    CHECK(webSocket >= 0 && sendAll(webSocket, request("/ws", std::string("Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: ") +
+                                                                   WEBSOCKET_KEY + "\r\n")),
+          "couldn't open /ws");
+    std::string handshake;
+    char byte;
+    while (handshake.find("\r\n\r\n") == std::string::npos && recv(webSocket, &byte, 1, 0) == 1)
+        handshake += byte;
+    CHECK(statusOf(handshake) == "HTTP/1.1 101 Switching Protocols", "/ws: %s", statusOf(handshake).c_str());
+    CHECK(handshake.find(std::string("Sec-WebSocket-Accept: ") + WEBSOCKET_ACCEPT + "\r\n") != std::string::npos,
+          "wrong accept key in: %s", handshake.c_str());
+    const std::string first = readFrame(webSocket);
+    CHECK(first.find("\"title\":\"First Song\"") != std::string::npos, "first frame: %s", first.c_str());
+
+    publishNowPlaying(playing("Second Song"));
+    const std::string pushed = readFrame(webSocket);
+    CHECK(pushed.find("\"title\":\"Second Song\"") != std::string::npos, "pushed frame: %s", pushed.c_str());
+
+    // the cover: named by its hash, then a 304 for the ETag it came with
+    const std::string png = std::string("\x89PNG\r\n\x1a\n", 8) + "not really a png";
+    publishArtwork(std::make_shared<const std::string>(png), 0x0123456789abcdefULL);
+    const std::string coverPath = "/artwork/0123456789abcdef.png";
+    const std::string withCover = readFrame(webSocket);
+    CHECK(withCover.find("\"artwork\":\"" + coverPath + "\"") != std::string::npos, "frame with the cover: %s", withCover.c_str());
+    close(webSocket);
+
+    const std::string cover = get(coverPath);
+    CHECK(statusOf(cover) == "HTTP/1.1 200 OK", "%s: %s", coverPath.c_str(), statusOf(cover).c_str());
+    CHECK(bodyOf(cover) == png, "cover bytes differ");
+    CHECK(cover.find("Content-Type: image/png") != std::string::npos, "cover isn't image/png");
+    const std::string etag = "\"0123456789abcdef\"";
+    CHECK(cover.find("ETag: " + etag) != std::string::npos, "no ETag %s", etag.c_str());
+    const std::string cached = get(coverPath, "If-None-Match: " + etag + "\r\n");
+    CHECK(statusOf(cached) == "HTTP/1.1 304 Not Modified", "If-None-Match: %s", statusOf(cached).c_str());
+    CHECK(bodyOf(cached).empty(), "304 with a body");
+
+    // who may ask: OBS (no Origin), a local file ("null") and the page itself, not another site
+    CHECK(statusOf(get("/now-playing", "Origin: null\r\n")) == "HTTP/1.1 200 OK", "Origin: null refused");
+    const std::string self = "Origin: http://127.0.0.1:" + std::to_string(port) + "\r\n";
+    CHECK(statusOf(get("/now-playing", self)) == "HTTP/1.1 200 OK", "the page's own origin refused");
+    CHECK(statusOf(get("/now-playing", "Origin: https://evil.example\r\n")) == "HTTP/1.1 403 Forbidden",
+          "a foreign Origin got through");
+    CHECK(statusOf(get("/ws", "Origin: https://evil.example\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " +
+                                  std::string(WEBSOCKET_KEY) + "\r\n")) == "HTTP/1.1 403 Forbidden",
+          "a foreign Origin opened /ws");
+
+    // a rebound name: no Origin at all on a same-origin GET, only the Host gives it away
+    const std::string rebound = "Host: evil.example:" + std::to_string(port) + "\r\n";
+    CHECK(statusOf(get("/now-playing", rebound)) == "HTTP/1.1 403 Forbidden", "a foreign Host got /now-playing");
+    CHECK(statusOf(get(coverPath, rebound)) == "HTTP/1.1 403 Forbidden", "a foreign Host got the cover");
+    CHECK(statusOf(get("/now-playing", "Host: localhost:" + std::to_string(port) + "\r\n")) == "HTTP/1.1 200 OK",
+          "Host: localhost refused");
+
+    stopOverlay();
+    return TestResult("overlay_server");
+}
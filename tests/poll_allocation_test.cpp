@@ -0,0 +1,212 @@
+// A steady poll tick allocates nothing: getMusicBeeInfo decoding the same track out of shared
+// memory, then PresencePipeline::Publish handing it to the sinks both builds run (Discord, the
+// history, the overlay, the text file). Operator new is replaced here to count, on every thread,
+// so the sinks' workers are included. The window's side of a tick (MainWindow::updateNowPlaying
+// and the artwork lookups in music_bee.cpp) needs Qt and isn't covered here.
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "check.h"
+#include "history_log.h"
+#include "musicbee_ipc.h"
+#include "overlay_server.h"
+#include "presence_bridge.h"
+#include "presence_sinks.h"
+
+namespace
+{
+    const int WARMUP_TICKS = 50;
+    const int STEADY_TICKS = 1000;
+
+    std::atomic<uint64_t> allocations{0};
+
+    // laid out the way MusicBee writes it: [C# long capacity][int32 byteCount][UTF-16 LE]
+    std::vector<char> sharedView(const std::u16string &text)
+    {
+        const int32_t byteCount = static_cast<int32_t>(text.size() * sizeof(char16_t));
+        std::vector<char> view(8 + sizeof(byteCount) + byteCount);
+        memcpy(view.data() + 8, &byteCount, sizeof(byteCount));
+        memcpy(view.data() + 8 + sizeof(byteCount), text.data(), byteCount);
+        return view;
+    }
+
+    struct SharedTrack
+    {
+        std::vector<char> title = sharedView(u"Symphonie Nr. 9 d-Moll, Op. 125 – IV. Presto – Allegro assai");
+        std::vector<char> artist = sharedView(u"Wiener Philharmoniker · Herbert von Karajan");
+        std::vector<char> album = sharedView(u"Symphonie Nr. 9");
+        std::vector<char> fileUrl = sharedView(u"D:\\Music\\Beethoven\\Symphonie Nr. 9\\04 - IV. Presto.flac");
+    };
+
+    const SharedTrack &track()
+    {
+        static const SharedTrack shared;
+        return shared;
+    }
+
+    size_t decode(const std::vector<char> &view, char *out, size_t capacity)
+    {
+        return MusicBeeIPC::DecodeSharedString(view.data(), view.size(), 0, out, capacity);
+    }
+
+    // counts what reached the last worker, so the test knows when a tick has gone through
+    class CountingSink : public PresenceSink
+    {
+    public:
+        explicit CountingSink(std::atomic<int> &consumed) : consumed(consumed) {}
+
+        SinkKind Kind() const override { return SinkKind::History; }
+        bool WantsEveryTick() const override { return true; }
+        void Consume(const std::shared_ptr<const NowPlaying> &) override { ++consumed; }
+
+    private:
+        std::atomic<int> &consumed;
+    };
+
+    void waitFor(const std::atomic<int> &consumed, int count)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (consumed.load() < count && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+    }
+
+    // until the counting sink has seen nothing new for a while; the other workers are done too
+    void waitForIdle(const std::atomic<int> &consumed)
+    {
+        int seen = -1;
+        while (consumed.load() != seen)
+        {
+            seen = consumed.load();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *memory = malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+// MusicBee playing one track, read through the same shared memory decode the Windows build uses.
+// Stands in for musicbee_ipc_stub.cpp, which is never linked in since every member is defined here
+bool MusicBeeIPC::Connect()
+{
+    ipcWindow = this;
+    return true;
+}
+
+void MusicBeeIPC::Disconnect()
+{
+    ipcWindow = nullptr;
+}
+
+bool MusicBeeIPC::IsConnected() const
+{
+    return ipcWindow != nullptr;
+}
+
+MBPlayState MusicBeeIPC::GetPlayState()
+{
+    return MBPlayState::Playing;
+}
+
+int MusicBeeIPC::GetPosition()
+{
+    return 61000;
+}
+
+int MusicBeeIPC::GetDuration()
+{
+    return 24 * 60 * 1000;
+}
+
+size_t MusicBeeIPC::GetFileUrl(char *out, size_t capacity)
+{
+    return decode(track().fileUrl, out, capacity);
+}
+
+size_t MusicBeeIPC::GetFileTag(MBMetaDataType tagType, char *out, size_t capacity)
+{
+    switch (tagType)
+    {
+    case MBMetaDataType::TrackTitle:
+        return decode(track().title, out, capacity);
+    case MBMetaDataType::Artist:
+        return decode(track().artist, out, capacity);
+    case MBMetaDataType::Album:
+        return decode(track().album, out, capacity);
+    }
+    return 0;
+}
+
+std::string MusicBeeIPC::GetArtwork()
+{
+    return "";
+}
+
+int main()
+{
+    const std::filesystem::path historyPath = std::filesystem::temp_directory_path() / "dmb_poll_allocation_test.dmbh";
+    const std::filesystem::path textPath = std::filesystem::temp_directory_path() / "dmb_poll_allocation_test.txt";
+    std::filesystem::remove(historyPath);
+
+    HistoryLog history;
+    CHECK(history.Open(historyPath.u8string()), "couldn't create %s", historyPath.u8string().c_str());
+    CHECK(startOverlay("127.0.0.1:0"), "couldn't start the overlay server");
+
+    MusicBeeIPC ipc;
+    std::atomic<int> consumed{0};
+    {
+        PresencePipeline pipeline;
+        addBridgeSinks(pipeline, history, textPath.u8string());
+        pipeline.Add(std::make_unique<CountingSink>(consumed));
+
+        // the first ticks of a track intern its tags and open the play. sent as one burst the
+        // workers can't keep up with, they also grow the snapshot pool to what backed up queues
+        // hold, so none of the ticks below finds every snapshot still in use
+        for (int i = 0; i < WARMUP_TICKS; ++i)
+            pipeline.Publish(getMusicBeeInfo(ipc), ipc);
+        waitForIdle(consumed);
+
+        // then one tick at a time, as the poll loop does
+        const int warmedUp = consumed.load();
+        const uint64_t before = allocations.load();
+        for (int i = 1; i <= STEADY_TICKS; ++i)
+        {
+            pipeline.Publish(getMusicBeeInfo(ipc), ipc);
+            waitFor(consumed, warmedUp + i);
+        }
+        waitForIdle(consumed);
+        const uint64_t steady = allocations.load() - before;
+
+        CHECK(consumed.load() == warmedUp + STEADY_TICKS, "%d of %d ticks went through", consumed.load() - warmedUp,
+              STEADY_TICKS);
+        CHECK(steady == 0, "%llu allocations over %d unchanged ticks", static_cast<unsigned long long>(steady), STEADY_TICKS);
+    }
+
+    stopOverlay();
+    history.Close();
+    std::filesystem::remove(historyPath);
+    std::filesystem::remove(textPath);
+    return TestResult("poll_allocation");
+}
@@ -0,0 +1,311 @@
+// Fuzzes the presence text cut in discord-rpc's serialization: Utf8ValidPrefixLength against a
+// plain table-driven UTF-8 check at every prefix length, and the state/details text
+// JsonWriteRichPresenceObj writes (WriteOptionalText) against what it should keep. Random strings
+// mix ASCII runs (quotes, backslashes, control characters), valid 2-4 byte code points and the
+// invalid forms: stray continuation bytes, sequences cut short, overlongs, surrogates, past
+// U+10FFFF. The fixed cases put each of those right at the 128 byte limit.
+//
+//   dmb_serialization_test [seed]
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "discord_rpc.h"
+#include "serialization.h"
+
+namespace
+{
+    // MaxPresenceTextBytes and the ellipsis in serialization.cpp
+    const size_t MAX_TEXT_BYTES = 128;
+    const std::string ELLIPSIS = "\xE2\x80\xA6";
+    const int RANDOM_STRINGS = 20000;
+
+    // Table 3-7 of the Unicode standard: the second byte's range depends on the lead, the rest are
+    // always 80..BF. Returns the sequence's length, or 0 if str[i] doesn't start a complete,
+    // well-formed one.
+    size_t wellFormedLength(const std::string &str, size_t i)
+    {
+        const auto byte = [&](size_t at)
+        { return at < str.size() ? static_cast<unsigned char>(str[at]) : 0x100u; };
+        const unsigned lead = byte(i);
+        unsigned secondLow = 0x80, secondHigh = 0xBF;
+        size_t length;
+        if (lead < 0x80)
+            return 1;
+        else if (lead >= 0xC2 && lead <= 0xDF)
+            length = 2;
+        else if (lead == 0xE0)
+            length = 3, secondLow = 0xA0;
+        else if (lead == 0xED)
+            length = 3, secondHigh = 0x9F;
+        else if (lead >= 0xE1 && lead <= 0xEF)
+            length = 3;
+        else if (lead == 0xF0)
+            length = 4, secondLow = 0x90;
+        else if (lead == 0xF4)
+            length = 4, secondHigh = 0x8F;
+        else if (lead >= 0xF1 && lead <= 0xF3)
+            length = 4;
+        else
+            return 0;
+
+        if (byte(i + 1) < secondLow || byte(i + 1) > secondHigh)
+            return 0;
+        for (size_t j = 2; j < length; ++j)
+        {
+            if (byte(i + j) < 0x80 || byte(i + j) > 0xBF)
+                return 0;
+        }
+        return length;
+    }
+
+    // every offset a valid prefix of str can end at, up to the first ill-formed sequence
+    std::vector<size_t> boundaries(const std::string &str)
+    {
+        std::vector<size_t> ends{0};
+        size_t i = 0;
+        while (i < str.size())
+        {
+            const size_t length = wellFormedLength(str, i);
+            if (length == 0)
+                break;
+            i += length;
+            ends.push_back(i);
+        }
+        return ends;
+    }
+
+    size_t expectedPrefix(const std::vector<size_t> &ends, size_t length)
+    {
+        size_t prefix = 0;
+        for (size_t end : ends)
+        {
+            if (end > length)
+                break;
+            prefix = end;
+        }
+        return prefix;
+    }
+
+    bool isValidUtf8(const std::string &str)
+    {
+        return boundaries(str).back() == str.size();
+    }
+
+    // what WriteOptionalText should put in the presence: the text as is if it's valid and fits,
+    // otherwise as much of its valid start as leaves room for an ellipsis, then the ellipsis
+    std::string expectedText(const std::string &value)
+    {
+        const size_t valid = expectedPrefix(boundaries(value), std::min(value.size(), MAX_TEXT_BYTES));
+        if (valid == value.size())
+            return value;
+        return value.substr(0, expectedPrefix(boundaries(value), std::min(valid, MAX_TEXT_BYTES - ELLIPSIS.size()))) + ELLIPSIS;
+    }
+
+    std::string encode(uint32_t codepoint)
+    {
+        std::string out;
+        if (codepoint < 0x80)
+            out += static_cast<char>(codepoint);
+        else if (codepoint < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (codepoint >> 6));
+            out += static_cast<char>(0x80 | (codepoint & 0x3F));
+        }
+        else if (codepoint < 0x10000)
+        {
+            out += static_cast<char>(0xE0 | (codepoint >> 12));
+            out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (codepoint & 0x3F));
+        }
+        else
+        {
+            // also writes the invalid F4 90.. forms past U+10FFFF
+            out += static_cast<char>(0xF0 | (codepoint >> 18));
+            out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (codepoint & 0x3F));
+        }
+        return out;
+    }
+
+    // never a nul byte: the presence fields are C strings
+    std::string randomText(std::mt19937 &random)
+    {
+        const auto pick = [&](uint32_t low, uint32_t high)
+        { return std::uniform_int_distribution<uint32_t>(low, high)(random); };
+        const size_t target = pick(0, 300);
+        std::string out;
+        while (out.size() < target)
+        {
+            const uint32_t kind = pick(0, 99);
+            if (kind < 40)
+            {
+                const char *special = "\"\\\x01\x1f/";
+                for (uint32_t n = pick(1, 20); n > 0; --n)
+                    out += pick(0, 7) == 0 ? special[pick(0, 4)] : static_cast<char>(pick(0x20, 0x7E));
+            }
+            else if (kind < 55)
+                out += encode(pick(0x80, 0x7FF));
+            else if (kind < 75)
+            {
+                uint32_t codepoint = pick(0x800, 0xFFFF);
+                if (codepoint >= 0xD800 && codepoint <= 0xDFFF)
+                    codepoint += 0x800;
+                out += encode(codepoint);
+            }
+            else if (kind < 90)
+                out += encode(pick(0x10000, 0x10FFFF));
+            else if (kind < 92)
+                out += static_cast<char>(pick(0x80, 0xBF)); // stray continuation byte
+            else if (kind < 94)
+            {
+                const std::string whole = encode(pick(0x800, 0x10FFFF));
+                out += whole.substr(0, pick(1, static_cast<uint32_t>(whole.size()) - 1)); // cut short
+            }
+            else if (kind < 95)
+                out += encode(pick(0xD800, 0xDFFF)); // surrogate
+            else if (kind < 96)
+                out += encode(pick(0x110000, 0x1FFFFF)); // past U+10FFFF
+            else if (kind < 97)
+            {
+                // overlong forms of ASCII and of 2 and 3 byte code points
+                const uint32_t form = pick(0, 2);
+                if (form == 0)
+                    out += std::string{static_cast<char>(0xC0 | pick(0, 1)), static_cast<char>(pick(0x80, 0xBF))};
+                else if (form == 1)
+                    out += std::string{'\xE0', static_cast<char>(pick(0x80, 0x9F)), static_cast<char>(pick(0x80, 0xBF))};
+                else
+                    out += std::string{'\xF0', static_cast<char>(pick(0x80, 0x8F)), static_cast<char>(pick(0x80, 0xBF)),
+                                       static_cast<char>(pick(0x80, 0xBF))};
+            }
+            else
+                out += static_cast<char>(pick(0xC0, 0xFF)); // any lead, usually without its tail
+        }
+        return out;
+    }
+
+    std::string hex(const std::string &str)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string out;
+        for (unsigned char c : str)
+        {
+            out += digits[c >> 4];
+            out += digits[c & 15];
+        }
+        return out;
+    }
+
+    void checkPrefixLengths(const std::string &str)
+    {
+        const std::vector<size_t> ends = boundaries(str);
+        for (size_t length = 0; length <= str.size(); ++length)
+        {
+            const size_t got = Utf8ValidPrefixLength(str.data(), length);
+            const size_t expected = expectedPrefix(ends, length);
+            CHECK(got == expected, "Utf8ValidPrefixLength(%s, %zu) = %zu, expected %zu", hex(str).c_str(), length, got, expected);
+            if (got != expected)
+                return;
+        }
+    }
+
+    // the text as it comes back out of the SET_ACTIVITY json; empty if the field was left out
+    bool writtenText(const std::string &state, const std::string &details, std::string &stateOut, std::string &detailsOut)
+    {
+        DiscordRichPresence presence{};
+        presence.state = state.c_str();
+        presence.details = details.c_str();
+        static char json[16 * 1024];
+        const size_t size = JsonWriteRichPresenceObj(json, sizeof(json), 1, 1, &presence);
+
+        rapidjson::Document document;
+        document.Parse<rapidjson::kParseValidateEncodingFlag>(json, size);
+        if (document.HasParseError() || !document.IsObject())
+            return false;
+        const auto &activity = document["args"]["activity"];
+        stateOut = activity.HasMember("state") ? activity["state"].GetString() : "";
+        detailsOut = activity.HasMember("details") ? activity["details"].GetString() : "";
+        return true;
+    }
+
+    void checkWrittenText(const std::string &state, const std::string &details)
+    {
+        std::string stateOut, detailsOut;
+        CHECK(writtenText(state, details, stateOut, detailsOut), "%s: not valid json", hex(state).c_str());
+        for (const auto &field : {std::make_pair(state, stateOut), std::make_pair(details, detailsOut)})
+        {
+            const std::string &in = field.first;
+            const std::string &out = field.second;
+            CHECK(out.size() <= MAX_TEXT_BYTES, "%s: %zu bytes written", hex(in).c_str(), out.size());
+            CHECK(isValidUtf8(out), "%s: wrote invalid utf-8 %s", hex(in).c_str(), hex(out).c_str());
+            const std::string expected = expectedText(in);
+            CHECK(out == expected, "%s: wrote %s, expected %s", hex(in).c_str(), hex(out).c_str(), hex(expected).c_str());
+        }
+    }
+
+    std::vector<std::string> boundaryCases()
+    {
+        const std::string a127(127, 'a'), a126(126, 'a'), a125(125, 'a'), a124(124, 'a');
+        return {
+            std::string(128, 'a'),               // fits exactly
+            std::string(129, 'a'),               // one over
+            a127 + "\xC3\xA9",                   // 2 byte code point across the limit
+            a126 + "\xC3\xA9",                   // 2 byte code point ending on it
+            a126 + "\xE2\x82\xAC",               // 3 byte code point across it
+            a125 + "\xE2\x82\xAC",               // ending on it
+            a125 + "\xF0\x9F\x8E\xB5",           // 4 byte code point across it
+            a124 + "\xF0\x9F\x8E\xB5",           // ending on it
+            a124 + "\xF0\x9F\x8E\xB5" + "b",     // ending on it, with more after
+            a125 + "\xC3\xA9\xC3\xA9",           // ellipsis has to replace a whole code point
+            a124 + "\xC3",                       // valid length, cut short at the end
+            a127 + "\xE2\x82",                   // cut short right at the limit
+            "\xE2\x82",                          // nothing but a cut short sequence
+            "\x80",                              // stray continuation byte
+            "abc\xBF" "def",                     // in the middle
+            "\xC0\x80",                          // overlong nul
+            "\xC1\xBF",                          // overlong ASCII
+            "\xE0\x9F\xBF",                      // overlong 3 byte
+            "\xF0\x8F\xBF\xBF",                  // overlong 4 byte
+            "\xED\xA0\x80",                      // high surrogate
+            "\xED\xBF\xBF",                      // low surrogate
+            "\xED\x9F\xBF",                      // U+D7FF, just below them
+            "\xF4\x8F\xBF\xBF",                  // U+10FFFF
+            "\xF4\x90\x80\x80",                  // U+110000
+            "\xF5\x80\x80\x80",                  // lead past F4
+            "\xFF",
+            "abcdefg\xC3\xA9" "abcdefgh",        // multibyte straddling an 8 byte block
+            std::string(300, 'a') + "\xFF",      // long ASCII run, invalid far past the limit
+            a127 + "\xFF",                       // invalid right on the limit
+        };
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const unsigned seed = argc > 1 ? static_cast<unsigned>(strtoul(argv[1], nullptr, 10)) : 20240611u;
+
+    for (const std::string &text : boundaryCases())
+    {
+        checkPrefixLengths(text);
+        checkWrittenText(text, "");
+        checkWrittenText("", text);
+    }
+
+    std::mt19937 random(seed);
+    for (int i = 0; i < RANDOM_STRINGS && TestFailures() < 20; ++i)
+    {
+        const std::string state = randomText(random);
+        const std::string details = randomText(random);
+        checkPrefixLengths(state);
+        checkWrittenText(state, details);
+    }
+
+    if (TestFailures())
+        fprintf(stderr, "seed %u\n", seed);
+    return TestResult("serialization");
+}